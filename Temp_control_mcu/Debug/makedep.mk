@@ -2,7 +2,45 @@
 # Automatically-generated file. Do not edit or delete the file
 ################################################################################
 
+adc.c
+
+autotune.c
+
+cmd.c
+
+config.c
+
+eeconf.c
+
+filter.c
+
+fmt.c
+
+hist.c
+
+idle.c
+
+instr.c
+
+keys.c
+
 lcd.c
 
 main.c
 
+menu.c
+
+pid.c
+
+sched.c
+
+sensor.c
+
+stack.c
+
+telem.c
+
+tprop.c
+
+uart.c
+
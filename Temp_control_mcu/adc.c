@@ -0,0 +1,243 @@
+/*
+ * adc.c
+ *
+ * Free-running multi-channel ADC acquisition with a lock-free sample ring
+ */ 
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#include "hal.h"
+#include "adc.h"
+#include "filter.h"
+#include "sched.h"
+#include "uart.h"
+
+#if ADC_DECIM_SHIFT > 6
+#error "ADC_DECIM_SHIFT > 6 overflows the 16-bit conversion sum"
+#endif
+#if ADC_RING_SIZE & (ADC_RING_SIZE - 1)
+#error "ADC_RING_SIZE must be a power of 2"
+#endif
+#if ADC_OVERSAMPLE_BITS * 2 > ADC_DECIM_SHIFT
+#error "ADC_OVERSAMPLE_BITS needs 4^n conversions per sample"
+#endif
+#if ADC_RESULT_BITS > 13
+#error "ADC_RESULT_BITS must fit next to the 3-bit ring tag"
+#endif
+#if ADC_NUM_CHANNELS > 8
+#error "ADC_NUM_CHANNELS must fit the 3-bit ring tag"
+#endif
+
+// ADC clock divider, the ADPS bits are the exponent
+#define ADC_CLOCK_DIV (1 << ADC_PRESCALER)
+#define ADC_CONV_CLOCKS 13		// ADC clocks per conversion
+
+#define ADC_RING_MASK (ADC_RING_SIZE - 1)
+
+// Ring entries carry the channel index in the top 3 bits
+#define ADC_TAG_SHIFT 13
+#define ADC_VALUE_MASK ((1 << ADC_TAG_SHIFT) - 1)
+
+static const uint8_t channels[ADC_NUM_CHANNELS] PROGMEM = { ADC_CHANNEL_LIST };
+
+// Ring written only by ADC_vect (head) and read only by the main loop (tail)
+static uint16_t ring[ADC_RING_SIZE];
+static volatile uint8_t head = 0;
+static volatile uint8_t tail = 0;
+static volatile uint16_t overruns = 0;
+
+// Scan and decimation state, ADC_vect only
+static uint8_t scanIdx = 0;
+static uint8_t discard = 0;
+static uint16_t convSum = 0;
+static uint8_t convCount = 0;
+
+#if ADC_NOISE_SLEEP
+static volatile uint8_t sampleDue = 0;		// set by adc_tick()
+static volatile uint8_t roundPending = 0;	// conversions left in this round
+static volatile uint8_t roundIdle = 0;		// round in Idle sleep, conversions started by hand
+static uint8_t sampleTicks = 0;
+static volatile uint16_t stopClocks = 0;	// ADC clocks converted with Timer0 stopped
+static uint16_t tickDebt = 0;				// Timer0 counts still to catch up on
+#endif
+
+// Per-channel filter state and published values, main loop only
+static filter_t filters[ADC_NUM_CHANNELS];
+static uint16_t values[ADC_NUM_CHANNELS];
+static uint16_t raws[ADC_NUM_CHANNELS];		// last unfiltered sample
+
+/*
+** ISR
+*/
+
+// One finished conversion into the decimation and the sample ring
+static inline void take(uint16_t conv)
+{
+	if (discard) {
+		discard--;
+		return;
+	}
+	
+	convSum += conv;
+	if (++convCount < (1 << ADC_DECIM_SHIFT)) return;
+	
+	uint8_t next = (head + 1) & ADC_RING_MASK;
+	if (next != tail) {
+		ring[head] = (convSum >> (ADC_DECIM_SHIFT - ADC_OVERSAMPLE_BITS)) | ((uint16_t)scanIdx << ADC_TAG_SHIFT);
+		head = next;
+		sched_post(SCHED_SAMPLE);
+	} else overruns++;
+	
+	convSum = 0;
+	convCount = 0;
+	
+#if ADC_NUM_CHANNELS > 1
+	// next channel, takes effect with the conversion after the running one
+	if (++scanIdx >= ADC_NUM_CHANNELS) scanIdx = 0;
+	hal_adc_mux(pgm_read_byte(&channels[scanIdx]));
+	discard = ADC_SETTLE_DISCARD;
+#endif
+#if ADC_NOISE_SLEEP
+	if (scanIdx == 0) roundPending = 0;
+#endif
+}
+
+ISR(ADC_vect) {
+	take(hal_adc_result());
+#if ADC_NOISE_SLEEP
+	if (!roundIdle) stopClocks += ADC_CONV_CLOCKS;
+	else if (roundPending) hal_adc_start();
+#endif
+}
+
+/*
+** Functions
+*/
+
+// Reset filters and set up conversions on the first channel
+void adc_init()
+{
+	for (uint8_t i = 0; i < ADC_NUM_CHANNELS; i++) {
+		filter_init(&filters[i]);
+		values[i] = 0;
+		raws[i] = 0;
+	}
+	
+	hal_adc_mux(pgm_read_byte(&channels[0]));
+	hal_adc_init(ADC_PRESCALER, !ADC_NOISE_SLEEP);
+}
+
+// Call from the Timer0 ISR, paces the noise reduction sampling rounds
+void adc_tick()
+{
+#if ADC_NOISE_SLEEP
+	if (++sampleTicks >= ADC_SAMPLE_TICKS) {
+		sampleTicks = 0;
+		sampleDue = 1;
+	}
+#endif
+}
+
+// Take a due round of samples, one conversion per ADC Noise Reduction sleep.
+// Other interrupts may wake the CPU early, the running conversion carries on
+// and the next sleep waits for it. That sleep stops clkI/O and with it the
+// USART, so while it is sending or has recently received the round runs in
+// Idle sleep instead, each conversion started by ADC_vect.
+// Timer0 stops as well, afterwards it is moved on by the conversion time,
+// what does not fit before its compare match waits for the next round.
+void adc_sample()
+{
+#if ADC_NOISE_SLEEP
+	uint16_t counts;
+	
+	if (!sampleDue) return;
+	sampleDue = 0;
+	roundPending = 1;
+	roundIdle = uart_busy();
+	
+	if (roundIdle) {
+		set_sleep_mode(SLEEP_MODE_IDLE);
+		hal_adc_start();
+	} else set_sleep_mode(SLEEP_MODE_ADC);
+	while (1) {
+		cli();
+		if (!roundPending) break;
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+	
+	counts = stopClocks / (HAL_TICK_PRESCALE / ADC_CLOCK_DIV);
+	stopClocks -= counts * (HAL_TICK_PRESCALE / ADC_CLOCK_DIV);
+	tickDebt += counts;
+	tickDebt -= hal_tick_advance(tickDebt > 255 ? 255 : tickDebt);
+	sei();
+#endif
+}
+
+// A noise reduction round is due, samples in the ring post SCHED_SAMPLE
+uint8_t adc_due()
+{
+#if ADC_NOISE_SLEEP
+	return sampleDue;
+#else
+	return 0;
+#endif
+}
+
+// Pop the oldest sample and its channel index, returns 0 when the ring is empty
+uint8_t adc_read(uint8_t *idx, uint16_t *sample)
+{
+	uint8_t t = tail;
+	
+	if (t == head) return 0;
+	*idx = ring[t] >> ADC_TAG_SHIFT;
+	*sample = ring[t] & ADC_VALUE_MASK;
+	tail = (t + 1) & ADC_RING_MASK;
+	return 1;
+}
+
+// Feed all pending samples through their channel filters,
+// returns a bit mask of the channel indexes whose value changed
+uint8_t adc_process()
+{
+	uint8_t idx, changed = 0;
+	uint16_t sample, avg;
+	
+	while (adc_read(&idx, &sample)) {
+		raws[idx] = sample;
+		avg = filter_update(&filters[idx], sample);
+		if (avg != values[idx]) {
+			values[idx] = avg;
+			changed |= _BV(idx);
+		}
+	}
+	return changed;
+}
+
+// Latest filtered value of a channel index
+uint16_t adc_get(uint8_t idx)
+{
+	return values[idx];
+}
+
+// Latest unfiltered sample of a channel index
+uint16_t adc_raw(uint8_t idx)
+{
+	return raws[idx];
+}
+
+// Samples lost because the main loop did not drain the ring in time
+uint16_t adc_overruns()
+{
+	uint16_t n;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		n = overruns;
+	}
+	return n;
+}
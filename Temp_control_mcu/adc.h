@@ -0,0 +1,56 @@
+/*
+ * adc.h
+ *
+ * Free-running multi-channel ADC acquisition. ADC_vect scans the channels in
+ * ADC_CHANNEL_LIST round-robin, sums 2^ADC_DECIM_SHIFT conversions into
+ * one oversampled sample, pushes it into a single-producer/single-consumer
+ * ring and posts SCHED_SAMPLE.
+ * adc_process() drains the ring in the main loop through a filter per
+ * channel and publishes the filtered values.
+ */ 
+#ifndef ADC_H
+#define ADC_H
+
+#include <inttypes.h>
+
+// Scanned ADC inputs, adc_get() index follows this order
+#define ADC_CHANNEL_LIST	0
+#define ADC_NUM_CHANNELS	1
+#define ADC_CH_TEMP			0		// index of the TMP35 input
+
+// Oversampling: 4^n conversions carry n extra bits when the input has about
+// 1 LSB of noise, samples are 10 + ADC_OVERSAMPLE_BITS bits wide
+#define ADC_DECIM_SHIFT		6		// 2^6 conversions per sample, max 6 for the 16-bit sum
+#define ADC_OVERSAMPLE_BITS	3		// at most ADC_DECIM_SHIFT / 2
+#define ADC_RESULT_BITS		(10 + ADC_OVERSAMPLE_BITS)
+#define ADC_RING_SIZE		32		// samples, power of 2
+
+// 1: every conversion runs in ADC Noise Reduction sleep, a round of samples
+//    for all channels is taken by adc_sample() every ADC_SAMPLE_TICKS calls of
+//    adc_tick(). CPU and I/O clocks stop during conversions, so Timer0/1/2
+//    pause too (~7% of the time at the defaults below).
+// 0: free-running conversions at F_CPU / prescaler / 13 / 2^ADC_DECIM_SHIFT
+//    samples/s for all channels together, 7372800 / 128 / 13 / 64 = ~69/s
+#define ADC_NOISE_SLEEP		1
+
+#if ADC_NOISE_SLEEP
+#define ADC_PRESCALER		(_BV(ADPS2) | _BV(ADPS1))				// clk/64 -> 115.2 kHz
+#define ADC_SAMPLE_TICKS	10		// Timer0 ticks per round, ~10 rounds/s
+#define ADC_SETTLE_DISCARD	1		// conversions dropped after a mux switch
+#else
+#define ADC_PRESCALER		(_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))	// clk/128 -> 57.6 kHz
+// one conversion still running on the old channel, one to settle
+#define ADC_SETTLE_DISCARD	2
+#endif
+
+void adc_init();
+uint8_t adc_read(uint8_t *idx, uint16_t *sample);
+uint8_t adc_process();
+uint16_t adc_get(uint8_t idx);
+uint16_t adc_raw(uint8_t idx);
+void adc_tick();
+void adc_sample();
+uint8_t adc_due();
+uint16_t adc_overruns();
+
+#endif //ADC_H
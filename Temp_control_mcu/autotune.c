@@ -0,0 +1,78 @@
+/*
+ * autotune.c
+ *
+ * Relay-method PID autotuning, integer only
+ */ 
+#include "autotune.h"
+
+// Begin a relay experiment around setpoint (0.1 C)
+void autotune_start(autotune_t *at, int16_t setpoint)
+{
+	at->state = AT_RUN;
+	at->setpoint = setpoint;
+	at->relayOn = 1;
+	at->cycles = 0;
+	at->ticks = 0;
+	at->lastRise = 0;
+	at->peakMax = -32768;
+	at->peakMin = 32767;
+	at->periodSum = 0;
+	at->ampSum = 0;
+}
+
+// One control period of the experiment, returns the relay output
+int16_t autotune_update(autotune_t *at, int16_t meas)
+{
+	if (at->state != AT_RUN) return 0;
+	
+	if (++at->ticks >= AT_TIMEOUT) {
+		at->state = AT_FAIL;
+		return 0;
+	}
+	
+	if (meas > at->peakMax) at->peakMax = meas;
+	if (meas < at->peakMin) at->peakMin = meas;
+	
+	if (at->relayOn && meas > at->setpoint + AT_HYST) {
+		at->relayOn = 0;
+	} else if (!at->relayOn && meas < at->setpoint - AT_HYST) {
+		// a full cycle ends at every switch back to high output
+		at->relayOn = 1;
+		if (at->cycles >= AT_SKIP) {
+			at->periodSum += at->ticks - at->lastRise;
+			at->ampSum += at->peakMax - at->peakMin;
+		}
+		at->lastRise = at->ticks;
+		at->peakMax = meas;
+		at->peakMin = meas;
+		if (++at->cycles >= AT_SKIP + AT_CYCLES) at->state = AT_DONE;
+	}
+	
+	return at->relayOn ? AT_OUT_HIGH : AT_OUT_LOW;
+}
+
+// Write Ziegler-Nichols gains from a finished experiment into pid,
+// returns 0 when there is no usable result
+uint8_t autotune_gains(const autotune_t *at, pidCtrl_t *pid)
+{
+	int32_t ku, tu, a, d, kp, ki, kd;
+	
+	if (at->state != AT_DONE) return 0;
+	
+	tu = at->periodSum / AT_CYCLES;					// control periods
+	a = at->ampSum / (2 * AT_CYCLES);				// 0.1 C
+	d = ((int32_t)AT_OUT_HIGH - AT_OUT_LOW) / 2;	// duty
+	if (tu < 2 || a < 1) return 0;
+	
+	// Ku in Q8.8 duty per 0.1 C, 4 / pi * 256 = 326
+	ku = d * 326 / a;
+	kp = ku * 3 / 5;
+	ki = ku * 6 / (5 * tu);
+	kd = ku * 3 * tu / 40;
+	
+	pid->kp = kp > 32767 ? 32767 : kp;
+	pid->ki = ki > 32767 ? 32767 : ki < 1 ? 1 : ki;
+	pid->kd = kd > 32767 ? 32767 : kd;
+	pid_reset(pid);
+	return 1;
+}
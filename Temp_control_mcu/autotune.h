@@ -0,0 +1,46 @@
+/*
+ * autotune.h
+ *
+ * Astrom-Hagglund relay autotuning. The output switches between
+ * AT_OUT_HIGH and AT_OUT_LOW whenever the temperature crosses the setpoint
+ * +-AT_HYST, the resulting limit cycle gives the ultimate period Tu and
+ * amplitude a, Ku = 4d / (pi a). PID gains follow Ziegler-Nichols:
+ * Kp = 0.6 Ku, Ki = 1.2 Ku / Tu, Kd = 0.075 Ku Tu (per control period).
+ */ 
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <inttypes.h>
+
+#include "pid.h"
+
+#define AT_OUT_HIGH		PID_OUT_MAX		// heater full on
+#define AT_OUT_LOW		(-PID_OUT_MAX)	// fan full on
+#define AT_HYST			2		// relay hysteresis, 0.1 C
+#define AT_SKIP			1		// cycles ignored while the oscillation builds up
+#define AT_CYCLES		3		// cycles averaged
+#define AT_TIMEOUT		14400	// control periods before giving up, ~2 h
+
+#define AT_IDLE		0
+#define AT_RUN		1
+#define AT_DONE		2
+#define AT_FAIL		3
+
+typedef struct{
+	uint8_t  state;
+	uint8_t  relayOn;
+	uint8_t  cycles;		// completed cycles, including skipped ones
+	int16_t  setpoint;
+	uint16_t ticks;			// control periods since start
+	uint16_t lastRise;		// tick of the last switch to AT_OUT_HIGH
+	int16_t  peakMax;
+	int16_t  peakMin;
+	uint16_t periodSum;
+	uint16_t ampSum;		// sum of peak-to-peak amplitudes
+}autotune_t;
+
+void autotune_start(autotune_t *at, int16_t setpoint);
+int16_t autotune_update(autotune_t *at, int16_t meas);
+uint8_t autotune_gains(const autotune_t *at, pidCtrl_t *pid);
+
+#endif //AUTOTUNE_H
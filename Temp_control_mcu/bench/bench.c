@@ -0,0 +1,324 @@
+/*
+ * bench.c
+ *
+ * Cycle and stack benchmarks of the hot paths, run under simavr. Timer1 runs
+ * at clk/1 as the cycle counter, the stack below SP is painted before every
+ * call and scanned afterwards. Results go out on the USART, one line each:
+ *   bench <name> cycles <n> stack <bytes>
+ */ 
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include <stdlib.h>
+
+#include "../lcd.h"
+#include "../filter.h"
+#include "../sensor.h"
+#include "../telem.h"
+#include "../fmt.h"
+
+#define BENCH_LOOPS		16		// main loop passes measured
+#define PAINT			0xC5
+
+// firmware entry points, main.c is built with -Dmain=app_main -DBENCH
+void setup();
+void mainLoop();
+uint8_t writeOnLCD();
+void bench_screen(uint8_t d);
+void TIMER0_COMP_vect(void);
+
+extern uint8_t __bss_end;
+
+static volatile uint16_t overflows;
+
+static filter_t filter;
+static uint16_t sample = 1000;
+
+// formatting inputs, volatile so the calls are not folded
+static volatile int16_t tenths = 215;
+static volatile uint8_t byteVal = 42;
+static volatile uint16_t count = 65535;
+static char fmtBuf[8];
+
+ISR(TIMER1_OVF_vect) {
+	overflows++;
+}
+
+/*
+** Output
+*/
+
+static void tx(char c)
+{
+	loop_until_bit_is_set(UCSRA, UDRE);
+	UDR = c;
+}
+
+static void tx_str(const char *s)
+{
+	while (*s) tx(*s++);
+}
+
+static void tx_str_p(const char *s)
+{
+	char c;
+	
+	while ((c = pgm_read_byte(s++))) tx(c);
+}
+
+static void tx_num(uint32_t n)
+{
+	char buf[11];
+	
+	ultoa(n, buf, 10);
+	tx_str(buf);
+}
+
+static void report(const char *name, uint32_t cycles, uint16_t stack)
+{
+	tx_str_p(PSTR("bench "));
+	tx_str_p(name);
+	tx_str_p(PSTR(" cycles "));
+	tx_num(cycles);
+	tx_str_p(PSTR(" stack "));
+	tx_num(stack);
+	tx('\n');
+}
+
+/*
+** Measurement
+*/
+
+// Cycles since the last reset of Timer1, a pending overflow is counted too
+static uint32_t cycles()
+{
+	uint16_t t, o;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		t = TCNT1;
+		o = overflows;
+		if ((TIFR & _BV(TOV1)) && t < 0x8000) o++;
+	}
+	return ((uint32_t)o << 16) | t;
+}
+
+static void paint()
+{
+	uint8_t *p = &__bss_end;
+	
+	while (p < (uint8_t *)SP - 16) *p++ = PAINT;
+}
+
+static uint16_t depth(uint16_t sp)
+{
+	uint8_t *p = &__bss_end;
+	
+	while (p < (uint8_t *)sp && *p == PAINT) p++;
+	return sp - (uint16_t)p;
+}
+
+// Run fn once with the interrupt flag given, returns cycles, stack use in *stack
+static uint32_t __attribute__((noinline)) run(void (*fn)(void), uint8_t irq, uint16_t *stack)
+{
+	uint32_t c;
+	uint16_t sp;
+	
+	cli();
+	paint();
+	sp = SP;
+	overflows = 0;
+	TCNT1 = 0;
+	TIFR = _BV(TOV1);
+	if (irq) sei();
+	fn();
+	c = cycles();
+	cli();
+	*stack = depth(sp);
+	sei();
+	return c;
+}
+
+static void measure(const char *name, void (*fn)(void), uint8_t irq)
+{
+	uint16_t stack;
+	uint32_t c = run(fn, irq, &stack);
+	
+	report(name, c, stack);
+}
+
+/*
+** Cases
+*/
+
+static void run_filter()
+{
+	filter_update(&filter, sample);
+}
+
+static void run_sensor()
+{
+	volatile int16_t t = sensor_to_tenths(sample);
+	(void)t;
+}
+
+// Temperature as showTemperature() formatted it with itoa()
+static void run_itoa_tenths()
+{
+	int16_t t = tenths;
+	
+	itoa(t / 10, fmtBuf, 10);
+	fmtBuf[4] = '0' + t % 10;
+}
+
+static void run_fmt_tenths()
+{
+	fmt_tenths(fmtBuf, tenths, 5);
+}
+
+static void run_utoa_u8()
+{
+	utoa(byteVal, fmtBuf, 10);
+}
+
+static void run_fmt_u8()
+{
+	fmt_u8(fmtBuf, byteVal, 2);
+}
+
+static void run_utoa_u16()
+{
+	utoa(count, fmtBuf, 10);
+}
+
+static void run_fmt_u16()
+{
+	fmt_u16(fmtBuf, count, FMT_U16_WIDTH);
+}
+
+// Timer0 tick that posts the refresh, control and telemetry events
+static void run_tick()
+{
+	TIMER0_COMP_vect();
+	cli();
+}
+
+static void run_putc()
+{
+	lcd_putc('x');
+}
+
+static void run_puts()
+{
+	lcd_puts("Temp: 21.5");
+}
+
+static void run_screen()
+{
+	writeOnLCD();
+}
+
+static void run_loop()
+{
+	mainLoop();
+}
+
+// Let Timer2 empty the LCD queue
+static void drain()
+{
+	sei();
+	while (lcd_queue_free() < LCD_QUEUE_SIZE - 1) ;
+}
+
+static const char nFilter[] PROGMEM = "filter_update";
+static const char nSensor[] PROGMEM = "sensor_to_tenths";
+static const char nTick[] PROGMEM = "TIMER0_COMP_vect";
+static const char nItoaTenths[] PROGMEM = "itoa_tenths";
+static const char nFmtTenths[] PROGMEM = "fmt_tenths";
+static const char nUtoaU8[] PROGMEM = "utoa_u8";
+static const char nFmtU8[] PROGMEM = "fmt_u8";
+static const char nUtoaU16[] PROGMEM = "utoa_u16";
+static const char nFmtU16[] PROGMEM = "fmt_u16";
+static const char nPutc[] PROGMEM = "lcd_putc";
+static const char nPuts[] PROGMEM = "lcd_puts";
+static const char nLoop[] PROGMEM = "mainLoop";
+static const char nLoopMax[] PROGMEM = "mainLoop_max";
+static const char nScreen[5][18] PROGMEM = {
+	"writeOnLCD_hello", "writeOnLCD_temp", "writeOnLCD_menu", "writeOnLCD_setpsw", "writeOnLCD_psw"
+};
+static const char nScreenIdle[5][23] PROGMEM = {
+	"writeOnLCD_hello_idle", "writeOnLCD_temp_idle", "writeOnLCD_menu_idle", "writeOnLCD_setpsw_idle", "writeOnLCD_psw_idle"
+};
+
+int main(void)
+{
+	uint8_t i;
+	uint16_t stack, stackMax = 0;
+	uint32_t c, sum = 0, max = 0;
+	
+	setup();
+	
+	// the results use the USART, no telemetry frames in between
+	telem_period(0);
+	
+	// 38400 baud, 8N1
+	UBRRL = F_CPU / 16 / 38400 - 1;
+	UCSRB = _BV(TXEN);
+	
+	// Timer1 as cycle counter, the fan PWM is off meanwhile
+	TCCR1A = 0;
+	TCCR1B = _BV(CS10);
+	TIMSK |= _BV(TOIE1);
+	
+	filter_init(&filter);
+	for (i = 0; i < 32; i++) filter_update(&filter, sample);
+	measure(nFilter, run_filter, 0);
+	measure(nSensor, run_sensor, 0);
+	measure(nTick, run_tick, 0);
+	
+	// number formatting, itoa()/utoa() against the fixed-width fields
+	measure(nItoaTenths, run_itoa_tenths, 0);
+	measure(nFmtTenths, run_fmt_tenths, 0);
+	measure(nUtoaU8, run_utoa_u8, 0);
+	measure(nFmtU8, run_fmt_u8, 0);
+	measure(nUtoaU16, run_utoa_u16, 0);
+	measure(nFmtU16, run_fmt_u16, 0);
+	
+	drain();
+	measure(nPutc, run_putc, 0);
+	drain();
+	measure(nPuts, run_puts, 0);
+	drain();
+	
+	// every screen once from a blank display, then again without changes
+	for (i = 0; i < 5; i++) {
+		bench_screen(i);
+		lcd_buf_invalidate();
+		measure(nScreen[i], run_screen, 0);
+		drain();
+		measure(nScreenIdle[i], run_screen, 0);
+		drain();
+	}
+	bench_screen(1);
+	
+	// main loop passes with interrupts on, ISRs included
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		c = run(run_loop, 1, &stack);
+		sum += c;
+		if (c > max) max = c;
+		if (stack > stackMax) stackMax = stack;
+	}
+	report(nLoop, sum / BENCH_LOOPS, stackMax);
+	report(nLoopMax, max, stackMax);
+	
+	tx_str_p(PSTR("done\n"));
+	_delay_ms(5);
+	
+	// simavr stops on sleep with interrupts off
+	cli();
+	sleep_enable();
+	sleep_cpu();
+	return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Compare benchmark results against a baseline.
+# usage: compare.sh baseline.txt results.txt [tolerance_percent]
+# Lines are "bench <name> cycles <n> stack <n>" and "size <flash|ram> <n>",
+# any value above baseline * (1 + tolerance / 100) is a regression. Without
+# a baseline there is nothing to compare and it exits 0.
+
+base=$1
+cur=$2
+tol=${3:-2}
+
+if [ ! -f "$base" ]; then
+	echo "no baseline in $base, run 'make baseline'"
+	exit 0
+fi
+
+awk -v tol="$tol" '
+function check(name, what, old, new) {
+	if (new > old * (1 + tol / 100)) {
+		printf "REGRESSION %-28s %-6s %8d -> %8d (%+.1f%%)\n", name, what, old, new, old ? (new - old) * 100 / old : 100
+		bad++
+	} else if (new < old) {
+		printf "improved   %-28s %-6s %8d -> %8d (%+.1f%%)\n", name, what, old, new, (new - old) * 100 / old
+	}
+}
+NR == FNR {
+	if ($1 == "bench") { cyc[$2] = $4; stk[$2] = $6 } else size[$2] = $3
+	next
+}
+$1 == "bench" {
+	if (!($2 in cyc)) { printf "new        %-28s cycles %8d\n", $2, $4; next }
+	check($2, "cycles", cyc[$2], $4)
+	check($2, "stack", stk[$2], $6)
+	next
+}
+$1 == "size" { if ($2 in size) check("size", $2, size[$2], $3) }
+END {
+	if (bad) { printf "%d regression(s), tolerance %s%%\n", bad, tol; exit 1 }
+	print "no regressions, tolerance " tol "%"
+}' "$base" "$cur"
@@ -0,0 +1,114 @@
+#!/bin/sh
+# Static worst case RAM use of the firmware against a budget.
+# usage: stack_budget.sh firmware.elf budget_bytes file.su...
+# Worst case is .data + .bss, the deepest call chain from main() and the
+# deepest interrupt handler on top of it (handlers run with interrupts off,
+# they do not nest). Frame sizes come from the avr-gcc -fstack-usage files
+# and include the return address, the call graph from the call/rcall and
+# jmp/rjmp targets in the disassembly. Indirect calls are not followed and
+# only reported. Fails when the total is above the budget.
+# Run by the bench Makefile and after the Debug build (Debug/Makefile, the
+# .cproj post-build event), there with OBJDUMP and SIZE set to the Atmel
+# Studio toolchain and sh/awk from e.g. Git for Windows on the PATH.
+
+elf=$1
+budget=$2
+shift 2
+
+OBJDUMP=${OBJDUMP:-avr-objdump}
+SIZE=${SIZE:-avr-size}
+
+# frame assumed for functions without a .su entry (libgcc/avr-libc assembly)
+UNKNOWN_FRAME=${UNKNOWN_FRAME:-8}
+
+static=$("$SIZE" -A "$elf" | awk '$1 == ".data" || $1 == ".bss" || $1 == ".noinit" { n += $2 } END { print n + 0 }')
+
+{ cat "$@"; echo "@@"; "$OBJDUMP" -d "$elf"; } | awk -v static="$static" -v budget="$budget" -v unknown="$UNKNOWN_FRAME" '
+function frame(f) {
+	if (f in su) return su[f]
+	nosu[f] = 1
+	return unknown
+}
+function depth(f,    n, i, d, best, callee) {
+	if (f in memo) return memo[f]
+	if (f in onPath) {
+		cycles[f] = 1
+		return 0
+	}
+	onPath[f] = 1
+	best = 0
+	n = split(calls[f], callee, " ")
+	for (i = 1; i <= n; i++) {
+		d = depth(callee[i])
+		if (d > best) {
+			best = d
+			via[f] = callee[i]
+		}
+	}
+	delete onPath[f]
+	return memo[f] = frame(f) + best
+}
+function chain(f,    s) {
+	s = f
+	while (f in via) {
+		f = via[f]
+		s = s " > " f
+	}
+	return s
+}
+function list(a,    f, s) {
+	s = ""
+	for (f in a) s = s " " f
+	return s
+}
+# Windows tools end their lines in CR
+{ sub(/\r$/, "") }
+# .su: file:line:col:name <tab> bytes <tab> static|dynamic[,bounded]
+!dis && $0 == "@@" { dis = 1; next }
+!dis {
+	split($0, col, "\t")
+	name = col[1]
+	sub(/.*:/, "", name)
+	if (!(name in su) || col[2] + 0 > su[name]) su[name] = col[2] + 0
+	if (col[3] != "static") dynamic[name] = 1
+	next
+}
+# disassembly: "0000007c <name>:" starts a function. Clones like
+# name.constprop.0 or name.isra.0 have their .su entry under the plain name.
+/^[0-9a-f]+ <[^>]+>:$/ {
+	cur = substr($2, 2, length($2) - 3)
+	sub(/\..*/, "", cur)
+	if (cur ~ /^__vector_[0-9]+$/) isrs[cur] = 1
+	next
+}
+# "  a4:	0e 94 3e 00 	call	0x7c	; 0x7c <name>", jumps inside a
+# function end in <name+0x12>
+cur != "" && /\t(r?call|r?jmp)\t/ && match($0, /<[^>+]+>$/) {
+	t = substr($0, RSTART + 1, RLENGTH - 2)
+	sub(/\..*/, "", t)
+	if (t != cur && index(" " calls[cur] " ", " " t " ") == 0) calls[cur] = calls[cur] " " t
+	next
+}
+cur != "" && /\te?icall/ { indirect[cur] = 1 }
+END {
+	mainDepth = depth("main")
+	isrDepth = 0
+	isr = "none"
+	for (f in isrs) if (depth(f) > isrDepth) {
+		isrDepth = depth(f)
+		isr = f
+	}
+	total = static + mainDepth + isrDepth
+	printf "static data %5d  .data + .bss\n", static
+	printf "main stack  %5d  %s\n", mainDepth, chain("main")
+	printf "isr stack   %5d  %s\n", isrDepth, isrDepth ? chain(isr) : isr
+	printf "total       %5d  of %d budget\n", total, budget
+	if (length(list(indirect))) print "warning: indirect calls not followed in" list(indirect)
+	if (length(list(dynamic))) print "warning: dynamic stack frames in" list(dynamic)
+	if (length(list(cycles))) print "warning: recursion through" list(cycles)
+	if (length(list(nosu))) printf "note: %d bytes assumed for%s\n", unknown, list(nosu)
+	if (total > budget) {
+		printf "RAM budget exceeded by %d bytes\n", total - budget
+		exit 1
+	}
+}'
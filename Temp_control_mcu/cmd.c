@@ -0,0 +1,285 @@
+/*
+ * cmd.c
+ *
+ * Incremental parser of the UART configuration commands
+ */ 
+#include <avr/pgmspace.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adc.h"
+#include "cmd.h"
+#include "config.h"
+#include "hist.h"
+#include "sensor.h"
+#include "telem.h"
+#include "uart.h"
+
+// Parser states
+#define CMD_GROUP	0		// start of a line
+#define CMD_INDEX	1		// after the group letter
+#define CMD_VALUE	2		// after '='
+#define CMD_SKIP	3		// bad input, wait for the end of the line
+
+#define CMD_ALL		0xFF	// '?' in place of a group
+#define CMD_HIST	0xFE	// 'h'
+#define CMD_CAL		0xFD	// 'c'
+#define CMD_INSTR	0xFC	// 'i', dumps like '?'
+
+static const char letters[3] PROGMEM = { 'v', 'a', 'm' };
+static const char errSyntax[] PROGMEM = "err syntax";
+static const char errIndex[] PROGMEM = "err index";
+static const char errRange[] PROGMEM = "err range ";
+static const char errCal[] PROGMEM = "err cal";
+
+// Command being parsed
+static uint8_t state = CMD_GROUP;
+static uint8_t group;
+static uint8_t idx;
+static uint8_t digits;
+static uint16_t value;
+
+// First calibration point, uncalibrated reading and reference in 0.1 C
+static int16_t calMeas, calRef;
+static uint8_t calPoint = 0;
+
+// Reply waiting for TX room, '?' walks all values, 'i' the instr_line()s
+static char reply[CMD_REPLY_MAX + 1];
+static uint8_t replyLen = 0;
+static uint8_t dumping = 0;
+static uint8_t dumpGroup, dumpIdx;
+
+static void reply_P(PGM_P msg)
+{
+	strcpy_P(reply, msg);
+	replyLen = strlen(reply);
+}
+
+// "v2=24", "m=1"
+static void reply_item(uint8_t g, uint8_t i)
+{
+	char *p = reply;
+	
+	*p++ = pgm_read_byte(&letters[g]);
+	if (g != CFG_MODE) {
+		utoa(i, p, 10);
+		p += strlen(p);
+	}
+	*p++ = '=';
+	utoa(config_get(g, i), p, 10);
+	replyLen = strlen(reply);
+}
+
+static void reply_range(uint8_t g, uint8_t i)
+{
+	char *p;
+	
+	reply_P(errRange);
+	p = reply + replyLen;
+	utoa(config_min(g, i), p, 10);
+	p += strlen(p);
+	*p++ = '.';
+	*p++ = '.';
+	utoa(config_max(g, i), p, 10);
+	replyLen = strlen(reply);
+}
+
+// "c=16384,-12", gain and offset of the sensor calibration
+static void reply_cal()
+{
+	char *p = reply;
+	
+	*p++ = 'c';
+	*p++ = '=';
+	utoa(config.calGain, p, 10);
+	p += strlen(p);
+	*p++ = ',';
+	itoa(config.calOffset, p, 10);
+	replyLen = strlen(reply);
+}
+
+// c, c0, c1=<ref>, c2=<ref>, returns 1 when the calibration changed
+static uint8_t calibrate()
+{
+	int16_t meas = sensor_raw_tenths(adc_get(ADC_CH_TEMP));
+	char *p = reply;
+	
+	if (state == CMD_INDEX) {
+		if (digits && idx != 0) {
+			reply_P(errIndex);
+			return 0;
+		}
+		if (digits) sensor_set_cal(SENSOR_GAIN_ONE, 0);
+	} else if (!digits) {
+		reply_P(errSyntax);
+		return 0;
+	} else if (idx == 1) {
+		// the reading the reference is compared with
+		calMeas = meas;
+		calRef = value;
+		calPoint = 1;
+		*p++ = 'c';
+		*p++ = '1';
+		*p++ = '=';
+		itoa(meas, p, 10);
+		replyLen = strlen(reply);
+		return 0;
+	} else if (idx == 2) {
+		if (!calPoint || !sensor_calibrate(calMeas, calRef, meas, value)) {
+			reply_P(errCal);
+			return 0;
+		}
+		calPoint = 0;
+	} else {
+		reply_P(errIndex);
+		return 0;
+	}
+	
+	// 'c' alone only reads
+	sensor_get_cal(&config.calGain, &config.calOffset);
+	reply_cal();
+	return digits != 0;
+}
+
+// Run the parsed command at the end of a line, returns 1 when a value changed
+static uint8_t execute()
+{
+	if (state == CMD_SKIP) {
+		reply_P(errSyntax);
+		return 0;
+	}
+	if (group == CMD_HIST) {
+		char *p = reply;
+		
+		*p++ = 'h';
+		*p++ = '=';
+		utoa(hist_export(), p, 10);
+		replyLen = strlen(reply);
+		return 0;
+	}
+	if (group == CMD_CAL) return calibrate();
+	if (group == CMD_ALL) {
+		dumping = 1;
+		dumpGroup = CFG_VARS;
+		dumpIdx = 0;
+		return 0;
+	}
+#if INSTRUMENT
+	if (group == CMD_INSTR) {
+		dumping = 1;
+		dumpGroup = CMD_INSTR;
+		dumpIdx = 0;
+		return 0;
+	}
+#endif
+	if (group != CFG_MODE && !digits && state == CMD_INDEX) {
+		reply_P(errSyntax);
+		return 0;
+	}
+	if (idx >= config_count(group)) {
+		reply_P(errIndex);
+		return 0;
+	}
+	if (state == CMD_VALUE) {
+		if (!digits) {
+			reply_P(errSyntax);
+			return 0;
+		}
+		if (value > 0xFF || !config_set(group, idx, value)) {
+			reply_range(group, idx);
+			return 0;
+		}
+		reply_item(group, idx);
+		return 1;
+	}
+	reply_item(group, idx);
+	return 0;
+}
+
+// Feed one received byte, returns 1 when a value changed
+static uint8_t feed(uint8_t c)
+{
+	uint8_t changed = 0;
+	
+	if (c == '\r' || c == '\n') {
+		if (state != CMD_GROUP) changed = execute();
+		state = CMD_GROUP;
+		return changed;
+	}
+	if (c == ' ' || state == CMD_SKIP) return 0;
+	
+	switch (state) {
+		case CMD_GROUP:
+		c |= 0x20;	// lower case
+		state = CMD_INDEX;
+		idx = 0;
+		digits = 0;
+		if (c == 'v') group = CFG_VARS;
+		else if (c == 'a') group = CFG_ALARMS;
+		else if (c == 'm') group = CFG_MODE;
+		else if (c == '?') group = CMD_ALL;
+		else if (c == 'h') group = CMD_HIST;
+		else if (c == 'c') group = CMD_CAL;
+#if INSTRUMENT
+		else if (c == 'i') group = CMD_INSTR;
+#endif
+		else state = CMD_SKIP;
+		break;
+		case CMD_INDEX:
+		if (c >= '0' && c <= '9' && (group < CFG_MODE || group == CMD_CAL) && idx < 10) {
+			idx = idx * 10 + c - '0';
+			digits++;
+		} else if (c == '=' && (group <= CFG_MODE || group == CMD_CAL) && (digits || group == CFG_MODE)) {
+			state = CMD_VALUE;
+			value = 0;
+			digits = 0;
+		} else state = CMD_SKIP;
+		break;
+		case CMD_VALUE:
+		if (c >= '0' && c <= '9') {
+			// saturate, anything above 255 is out of range anyway,
+			// calibration references go up to 999.9 C
+			if (value < 1000) value = value * 10 + c - '0';
+			digits++;
+		} else state = CMD_SKIP;
+		break;
+	}
+	return 0;
+}
+
+// Call from the main loop: sends a waiting reply when the TX ring has room,
+// then parses received bytes up to the next reply.
+// Returns 1 when a command changed the configuration.
+uint8_t cmd_poll()
+{
+	uint8_t c, changed = 0;
+	
+	while (1) {
+		if (replyLen) {
+			if (!telem_fits(replyLen)) break;
+			telem_begin(TELEM_TEXT, replyLen);
+			for (c = 0; c < replyLen; c++) telem_put8(reply[c]);
+			telem_end();
+			replyLen = 0;
+		}
+		if (dumping) {
+#if INSTRUMENT
+			if (dumpGroup == CMD_INSTR) {
+				// sections without data yet skip lines, replyLen 0
+				replyLen = instr_line(dumpIdx, reply);
+				if (++dumpIdx >= INSTR_LINES) dumping = 0;
+				continue;
+			}
+#endif
+			reply_item(dumpGroup, dumpIdx);
+			if (++dumpIdx >= config_count(dumpGroup)) {
+				dumpIdx = 0;
+				if (++dumpGroup > CFG_MODE) dumping = 0;
+			}
+			continue;
+		}
+		if (!uart_getc(&c)) break;
+		changed |= feed(c);
+	}
+	return changed;
+}
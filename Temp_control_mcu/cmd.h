@@ -0,0 +1,40 @@
+/*
+ * cmd.h
+ *
+ * Remote configuration over the USART, one command per line (CR or LF):
+ *   v<i>        read variable i (config.h CFG_MAX_TEMP..CFG_TEMP_DIFF)
+ *   v<i>=<n>    write it, with the same range rules as the key menu
+ *   a<i>        read alarm setting i (CFG_ALARM_DIFF..CFG_LOCK_USE)
+ *   a<i>=<n>    write it
+ *   m / m=<n>   read / write the working mode (0 heat .. 3 autotune)
+ *   ?           read everything, one reply per value
+ *   h           export the history (hist.h), replies "h=<records>"
+ *   c           read the sensor calibration, "c=<gain Q2.14>,<offset 0.1 C>"
+ *   c1=<t>      first calibration point: the sensor is at t 0.1 C now,
+ *               replies "c1=<uncalibrated reading>"
+ *   c2=<t>      second point, at least 5 C away: calibrates and replies
+ *               like 'c', or "err cal" when the points do not fit
+ *   c0          back to no calibration
+ *   i           instrumented build (instr.h): the timing statistics, one
+ *               reply per instr_line(), "tick n 1203", "tick max 61", ...
+ * Every command gets one reply as a TELEM_TEXT frame: "v2=24" with the
+ * stored value, or "err syntax", "err index", "err range 1..50".
+ * Received bytes are parsed one at a time, no line buffer, and a reply
+ * waits in the main loop until the TX ring has room for it.
+ */ 
+#ifndef CMD_H
+#define CMD_H
+
+#include <inttypes.h>
+
+#include "instr.h"
+
+#if INSTRUMENT
+#define CMD_REPLY_MAX	INSTR_LINE_MAX	// longest reply, an 'i' line
+#else
+#define CMD_REPLY_MAX	16		// longest reply, "err range 99..99"
+#endif
+
+uint8_t cmd_poll();
+
+#endif //CMD_H
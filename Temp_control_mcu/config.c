@@ -0,0 +1,146 @@
+/*
+ * config.c
+ *
+ * User configuration values and their range rules
+ */ 
+#include <avr/pgmspace.h>
+#include <string.h>
+
+#include "config.h"
+#include "pid.h"
+#include "sensor.h"
+
+#define CFG_ABS		0xFF	// bound is the offset itself
+
+// Value range, each bound is a constant or another value of the same group
+// plus an offset
+typedef struct{
+	int8_t lo;
+	uint8_t loRef;
+	int8_t hi;
+	uint8_t hiRef;
+}cfgRange_t;
+
+// Variables, alarms, mode, in index order
+static const cfgRange_t ranges[CFG_NUM_VARS + CFG_NUM_ALARMS + 1] PROGMEM = {
+	{ 1, CFG_MIN_TEMP,	99, CFG_ABS },				// max temp
+	{ 0, CFG_ABS,		-1, CFG_MAX_TEMP },			// min temp
+	{ 0, CFG_MIN_TEMP,	0, CFG_MAX_TEMP },			// set temp
+	{ 0, CFG_ABS,		30, CFG_ABS },				// temp diff
+	{ 1, CFG_ABS,		50, CFG_ABS },				// alarm diff
+	{ 1, CFG_ALARM_LOW,	99, CFG_ABS },				// alarm high
+	{ 0, CFG_ABS,		-1, CFG_ALARM_HIGH },		// alarm low
+	{ 0, CFG_ABS,		1, CFG_ABS },				// alarm usage
+	{ 0, CFG_ABS,		1, CFG_ABS },				// lock usage
+	{ 0, CFG_ABS,		CFG_NUM_MODES - 1, CFG_ABS },	// working mode
+};
+
+config_t config;
+
+static uint8_t *item(uint8_t group, uint8_t idx)
+{
+	if (group == CFG_VARS) return &config.var_mat[idx];
+	if (group == CFG_ALARMS) return &config.alarms_mat[idx];
+	return &config.modeSelect;
+}
+
+// Keep the set temperature inside the min/max temperature window
+static void clamp_set()
+{
+	uint8_t *set = &config.var_mat[CFG_SET_TEMP];
+	
+	if (*set > config.var_mat[CFG_MAX_TEMP]) *set = config.var_mat[CFG_MAX_TEMP];
+	if (*set < config.var_mat[CFG_MIN_TEMP]) *set = config.var_mat[CFG_MIN_TEMP];
+}
+
+// Power-up values, password '0000' (not used)
+void config_defaults()
+{
+	config.var_mat[CFG_MAX_TEMP] = 99;
+	config.var_mat[CFG_MIN_TEMP] = 0;
+	config.var_mat[CFG_SET_TEMP] = 0;
+	config.var_mat[CFG_TEMP_DIFF] = 2;
+	
+	config.alarms_mat[CFG_ALARM_DIFF] = 2;
+	config.alarms_mat[CFG_ALARM_HIGH] = 50;
+	config.alarms_mat[CFG_ALARM_LOW] = 0;
+	config.alarms_mat[CFG_ALARM_USE] = 0;
+	config.alarms_mat[CFG_LOCK_USE] = 0;
+	
+	config.modeSelect = 0;
+	memset(config.password, '0', sizeof(config.password));
+	
+	config.calGain = SENSOR_GAIN_ONE;
+	config.calOffset = 0;
+	
+	config.kp = PID_KP_DEFAULT;
+	config.ki = PID_KI_DEFAULT;
+	config.kd = PID_KD_DEFAULT;
+}
+
+// Number of values in a group
+uint8_t config_count(uint8_t group)
+{
+	return group == CFG_VARS ? CFG_NUM_VARS : group == CFG_ALARMS ? CFG_NUM_ALARMS : 1;
+}
+
+static const cfgRange_t *range(uint8_t group, uint8_t idx)
+{
+	if (group == CFG_ALARMS) idx += CFG_NUM_VARS;
+	else if (group == CFG_MODE) idx = CFG_NUM_VARS + CFG_NUM_ALARMS;
+	return &ranges[idx];
+}
+
+static uint8_t bound(uint8_t group, const int8_t *off, const uint8_t *ref)
+{
+	uint8_t r = pgm_read_byte(ref);
+	int8_t o = pgm_read_byte(off);
+	
+	return r == CFG_ABS ? o : *item(group, r) + o;
+}
+
+// Smallest allowed value, may depend on the other values
+uint8_t config_min(uint8_t group, uint8_t idx)
+{
+	const cfgRange_t *r = range(group, idx);
+	
+	return bound(group, &r->lo, &r->loRef);
+}
+
+// Largest allowed value, may depend on the other values
+uint8_t config_max(uint8_t group, uint8_t idx)
+{
+	const cfgRange_t *r = range(group, idx);
+	
+	return bound(group, &r->hi, &r->hiRef);
+}
+
+uint8_t config_get(uint8_t group, uint8_t idx)
+{
+	return *item(group, idx);
+}
+
+// Store a value, returns 0 and changes nothing when it is out of range.
+// A new min/max temperature pulls the set temperature along.
+uint8_t config_set(uint8_t group, uint8_t idx, uint8_t value)
+{
+	if (idx >= config_count(group)) return 0;
+	if (value < config_min(group, idx) || value > config_max(group, idx)) return 0;
+	*item(group, idx) = value;
+	if (group == CFG_VARS) clamp_set();
+	return 1;
+}
+
+// Menu keys: delta up or down, stopping at the range end first and
+// with wrap set going around on the next step
+void config_step(uint8_t group, uint8_t idx, int8_t delta, uint8_t wrap)
+{
+	uint8_t v = *item(group, idx);
+	uint8_t lo = config_min(group, idx);
+	uint8_t hi = config_max(group, idx);
+	
+	if (v < lo || v > hi) v = delta > 0 ? lo : hi;
+	else if (delta > 0) v = v < hi ? (hi - v < delta ? hi : v + delta) : wrap ? lo : hi;
+	else v = v > lo ? (v - lo < -delta ? lo : v + delta) : wrap ? hi : lo;
+	config_set(group, idx, v);
+}
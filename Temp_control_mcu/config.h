@@ -0,0 +1,61 @@
+/*
+ * config.h
+ *
+ * User configuration: the menu variables and alarms, the working mode and the
+ * menu password. The key menu and the UART commands change values only
+ * through config_set() and config_step(), which share the range table in
+ * config.c.
+ * Values are whole degrees C, owned by the main loop. The sensor calibration
+ * is stored here too, it is set through the 'c' UART commands (cmd.h), and
+ * the PID gains found by the last autotune.
+ */ 
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <inttypes.h>
+
+// Groups for config_get()/config_set()/config_step()
+#define CFG_VARS		0
+#define CFG_ALARMS		1
+#define CFG_MODE		2		// single value, index 0
+
+// var_mat indexes
+#define CFG_MAX_TEMP	0		// upper bound of set temp, min temp + 1..99
+#define CFG_MIN_TEMP	1		// lower bound of set temp, 0..max temp - 1
+#define CFG_SET_TEMP	2		// set point, min temp..max temp
+#define CFG_TEMP_DIFF	3		// deadband, 0..30
+#define CFG_NUM_VARS	4
+
+// alarms_mat indexes
+#define CFG_ALARM_DIFF	0		// alarm on this far from set, 1..50
+#define CFG_ALARM_HIGH	1		// alarm low + 1..99
+#define CFG_ALARM_LOW	2		// 0..alarm high - 1
+#define CFG_ALARM_USE	3		// 0/1
+#define CFG_LOCK_USE	4		// 0/1, no menu while the output is active
+#define CFG_NUM_ALARMS	5
+
+#define CFG_NUM_MODES	4		// heat, cool, balance, autotune
+
+typedef struct{
+	uint8_t var_mat[CFG_NUM_VARS];
+	uint8_t alarms_mat[CFG_NUM_ALARMS];
+	uint8_t modeSelect;
+	char password[4];
+	uint16_t calGain;		// sensor calibration, sensor_set_cal()
+	int16_t calOffset;
+	int16_t kp;				// PID gains, Q8.8 (pid.h)
+	int16_t ki;
+	int16_t kd;
+}config_t;
+
+extern config_t config;
+
+void config_defaults();
+uint8_t config_count(uint8_t group);
+uint8_t config_min(uint8_t group, uint8_t idx);
+uint8_t config_max(uint8_t group, uint8_t idx);
+uint8_t config_get(uint8_t group, uint8_t idx);
+uint8_t config_set(uint8_t group, uint8_t idx, uint8_t value);
+void config_step(uint8_t group, uint8_t idx, int8_t delta, uint8_t wrap);
+
+#endif //CONFIG_H
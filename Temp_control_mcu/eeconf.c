@@ -0,0 +1,139 @@
+/*
+ * eeconf.c
+ *
+ * Wear-levelled, write-behind EEPROM storage of the configuration
+ */ 
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "hal.h"
+#include "eeconf.h"
+
+#if EECONF_BASE + EECONF_SLOTS * EECONF_SLOT_SIZE > HAL_EEPROM_SIZE
+#error "EECONF_SLOTS do not fit the EEPROM"
+#endif
+
+typedef char eeconf_slot_check[sizeof(eeRec_t) <= EECONF_SLOT_SIZE ? 1 : -1];
+
+// Last record loaded or saved, the EE_RDY interrupt writes it out of here
+static eeRec_t rec;
+static uint8_t slot = 0;				// slot of rec
+static volatile uint8_t busy = 0;		// EE_RDY writing rec
+static uint8_t wrPos;					// next byte of rec, EE_RDY only
+
+// Edit tracking, main loop only
+static config_t seen;					// config as of the last poll
+static uint8_t pending = 0;				// seen differs from the stored record
+static volatile uint16_t quiet = 0;		// Timer0 ticks since the last edit
+
+/*
+** ISR
+*/
+
+ISR(EE_RDY_vect) {
+	uint16_t addr = EECONF_BASE + slot * EECONF_SLOT_SIZE;
+	uint8_t byte;
+	
+	while (wrPos < sizeof(rec)) {
+		byte = ((uint8_t *)&rec)[wrPos];
+		wrPos++;
+		if (hal_eeprom_read(addr + wrPos - 1) != byte) {
+			hal_eeprom_write(addr + wrPos - 1, byte);
+			return;
+		}
+	}
+	hal_eeprom_irq(0);
+	busy = 0;
+}
+
+/*
+** Functions
+*/
+
+static uint16_t rec_crc(const eeRec_t *r)
+{
+	const uint8_t *p = (const uint8_t *)r;
+	uint16_t crc = 0xFFFF;
+	
+	for (uint8_t i = 0; i < offsetof(eeRec_t, crc); i++) crc = _crc_xmodem_update(crc, p[i]);
+	return crc;
+}
+
+// Load the newest valid record into config, defaults when there is none.
+// Returns 1 when a record was found. Call before interrupts are on.
+uint8_t eeconf_load()
+{
+	eeRec_t r;
+	uint8_t i, j, found = 0;
+	
+	for (i = 0; i < EECONF_SLOTS; i++) {
+		for (j = 0; j < sizeof(r); j++)
+			((uint8_t *)&r)[j] = hal_eeprom_read(EECONF_BASE + i * EECONF_SLOT_SIZE + j);
+		if (r.version != EECONF_VERSION || r.crc != rec_crc(&r)) continue;
+		// sequence numbers wrap, newer is ahead by less than half the range
+		if (found && (int8_t)(r.seq - rec.seq) <= 0) continue;
+		rec = r;
+		slot = i;
+		found = 1;
+	}
+	
+	if (found) config = rec.config;
+	else {
+		config_defaults();
+		// first save goes to slot 0
+		rec.seq = 0xFF;
+		slot = EECONF_SLOTS - 1;
+		rec.config = config;
+	}
+	seen = config;
+	return found;
+}
+
+// Call from the Timer0 ISR
+void eeconf_tick()
+{
+	if (quiet != 0xFFFF) quiet++;
+}
+
+// Call from the main loop, starts a save once the edits have settled
+void eeconf_poll()
+{
+	uint16_t q;
+	
+	if (memcmp(&seen, &config, sizeof(config))) {
+		seen = config;
+		pending = 1;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			quiet = 0;
+		}
+		return;
+	}
+	if (!pending || busy) return;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		q = quiet;
+	}
+	if (q < EECONF_DELAY_TICKS) return;
+	
+	pending = 0;
+	// edited back to what is stored
+	if (!memcmp(&rec.config, &config, sizeof(config))) return;
+	
+	rec.version = EECONF_VERSION;
+	rec.seq++;
+	rec.config = config;
+	rec.crc = rec_crc(&rec);
+	if (++slot >= EECONF_SLOTS) slot = 0;
+	wrPos = 0;
+	busy = 1;
+	hal_eeprom_irq(1);
+}
+
+// A save is running
+uint8_t eeconf_busy()
+{
+	return busy;
+}
@@ -0,0 +1,37 @@
+/*
+ * eeconf.h
+ *
+ * Configuration record in EEPROM. Every save goes to the next of
+ * EECONF_SLOTS slots, a record carries a layout version, a sequence number
+ * and a CRC-16, so the newest valid slot wins at boot and a write cut short
+ * by a reset leaves the previous one in place.
+ * Saving is write-behind: eeconf_poll() notices edits to config and once
+ * nothing changed for EECONF_DELAY_TICKS the EEPROM ready interrupt writes
+ * the record one byte at a time, skipping bytes that already hold the value.
+ */ 
+#ifndef EECONF_H
+#define EECONF_H
+
+#include <inttypes.h>
+
+#include "config.h"
+
+#define EECONF_VERSION		3		// bump when config_t changes
+#define EECONF_BASE			0		// EEPROM address of slot 0
+#define EECONF_SLOTS		8
+#define EECONF_SLOT_SIZE	32		// bytes, at least sizeof(eeRec_t)
+#define EECONF_DELAY_TICKS	296		// Timer0 ticks without edits before a save, ~3 s
+
+typedef struct{
+	uint8_t version;
+	uint8_t seq;		// +1 per save, wraps
+	config_t config;
+	uint16_t crc;		// CRC-16/CCITT-FALSE over version..config
+}eeRec_t;
+
+uint8_t eeconf_load();
+void eeconf_tick();
+void eeconf_poll();
+uint8_t eeconf_busy();
+
+#endif //EECONF_H
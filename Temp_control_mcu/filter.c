@@ -0,0 +1,160 @@
+/*
+ * filter.c
+ *
+ * Sample filters for the ADC channels
+ */ 
+#include <string.h>
+
+#include "filter.h"
+
+#if FILTER_TYPE == FILTER_CIC && CIC_SHIFT != CIC_ORDER * CIC_DECIM_SHIFT
+#error "CIC_SHIFT must be log2(CIC_DECIM^CIC_ORDER), the CIC gain"
+#endif
+
+#if FILTER_TYPE == FILTER_BOXCAR
+
+// Calculate moving average
+uint16_t filter_update(filter_t *ma, uint16_t newSample)
+{
+	uint8_t i;
+	
+	// The first sample fills the window, no ramp up from 0
+	if (ma->samIdx < 0) {
+		for (i = 0; i < TOT_SAMPLES; i++) ma->samples[i] = newSample;
+		ma->sum = (uint32_t)newSample * TOT_SAMPLES;
+		ma->samIdx = 0;
+	}
+	
+	// Remove oldest sample from the sum
+	ma->sum -= ma->samples[ma->samIdx];
+	// Add the new sample to the sum and to samples array
+	ma->sum += newSample;
+	ma->samples[ma->samIdx] = newSample;
+	// Increment index and roll down to 0 if necessary
+	ma->samIdx++;
+	if( ma->samIdx == TOT_SAMPLES ){
+		ma->samIdx = 0;
+	}
+
+	// return moving average - divide the sum by 2^MOVAVG_SHIFT
+	return ma->sum >> MOVAVG_SHIFT;
+}
+
+#elif FILTER_TYPE == FILTER_EMA
+
+// Exponential moving average, no sample history
+uint16_t filter_update(filter_t *f, uint16_t newSample)
+{
+	// The first sample is the output, no ramp up from 0
+	if (!f->seeded) {
+		f->acc = (uint32_t)newSample << EMA_SHIFT;
+		f->seeded = 1;
+	}
+	
+	f->acc += newSample - (f->acc >> EMA_SHIFT);
+	return f->acc >> EMA_SHIFT;
+}
+
+#elif FILTER_TYPE == FILTER_CIC
+
+// CIC decimator, integrators run at the input rate and the combs at
+// 1/CIC_DECIM of it. Wrap-around of the 32-bit registers cancels out in
+// the combs, the output holds between decimation points.
+static uint16_t cic_step(filter_t *f, uint16_t newSample)
+{
+	uint32_t x = newSample;
+	uint32_t prev;
+	uint8_t i;
+	
+	for (i = 0; i < CIC_ORDER; i++) {
+		f->integ[i] += x;
+		x = f->integ[i];
+	}
+	
+	if (++f->phase < CIC_DECIM) return f->out;
+	f->phase = 0;
+	
+	for (i = 0; i < CIC_ORDER; i++) {
+		prev = f->comb[i];
+		f->comb[i] = x;
+		x -= prev;
+	}
+	f->out = x >> CIC_SHIFT;
+	return f->out;
+}
+
+uint16_t filter_update(filter_t *f, uint16_t newSample)
+{
+	// The first sample is fed until the combs have settled on it, after
+	// CIC_ORDER decimation points the output is the sample itself
+	if (!f->seeded) {
+		for (uint8_t n = 1; n < CIC_ORDER * CIC_DECIM; n++) cic_step(f, newSample);
+		f->seeded = 1;
+	}
+	return cic_step(f, newSample);
+}
+
+#elif FILTER_TYPE == FILTER_HAMPEL
+
+// Sort a small array in place
+static void sort_small(uint16_t *v, uint8_t n)
+{
+	uint8_t i, j;
+	uint16_t key;
+	
+	for (i = 1; i < n; i++) {
+		key = v[i];
+		for (j = i; j > 0 && v[j - 1] > key; j--) v[j] = v[j - 1];
+		v[j] = key;
+	}
+}
+
+// Hampel identifier over the last HAMPEL_N samples: a sample that is an
+// outlier against the window median and MAD is replaced by the median,
+// the result is smoothed by an EMA
+uint16_t filter_update(filter_t *f, uint16_t newSample)
+{
+	uint16_t sorted[HAMPEL_N];
+	uint16_t median, mad, dev;
+	uint8_t i;
+	
+	// The first sample fills the window and seeds the EMA, so it is not
+	// an outlier against a median of 0
+	if (f->idx < 0) {
+		for (i = 0; i < HAMPEL_N; i++) f->window[i] = newSample;
+		f->acc = (uint32_t)newSample << EMA_SHIFT;
+		f->idx = 0;
+	}
+	
+	f->window[f->idx] = newSample;
+	if (++f->idx == HAMPEL_N) f->idx = 0;
+	
+	memcpy(sorted, f->window, sizeof(sorted));
+	sort_small(sorted, HAMPEL_N);
+	median = sorted[HAMPEL_N / 2];
+	
+	for (i = 0; i < HAMPEL_N; i++) {
+		sorted[i] = sorted[i] > median ? sorted[i] - median : median - sorted[i];
+	}
+	sort_small(sorted, HAMPEL_N);
+	mad = sorted[HAMPEL_N / 2];
+	
+	dev = newSample > median ? newSample - median : median - newSample;
+	if (dev > HAMPEL_K * mad + HAMPEL_MIN) newSample = median;
+	
+	f->acc += newSample - (f->acc >> EMA_SHIFT);
+	return f->acc >> EMA_SHIFT;
+}
+
+#endif
+
+// Initialize filter state
+void filter_init(filter_t *f)
+{
+	memset(f, 0, sizeof(*f));
+#if FILTER_TYPE == FILTER_BOXCAR
+	f->samIdx = -1;
+#elif FILTER_TYPE == FILTER_HAMPEL
+	f->idx = -1;
+#endif
+}
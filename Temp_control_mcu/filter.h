@@ -0,0 +1,88 @@
+/*
+ * filter.h
+ *
+ * Sample filters for the ADC channels, one stage selected at compile time
+ * with FILTER_TYPE. All stages run in O(1) per sample except the Hampel
+ * window sort, which is O(N^2) for a fixed small N.
+ *
+ * Every stage starts from its first sample, no ramp up from 0.
+ *
+ * RAM per channel (sizeof(filter_t), packed):
+ *   FILTER_BOXCAR   69 bytes   32-tap moving average
+ *   FILTER_EMA       5 bytes   y += (x - y) / 2^EMA_SHIFT
+ *   FILTER_CIC      20 bytes   order-2 CIC, decimates by CIC_DECIM
+ *   FILTER_HAMPEL   15 bytes   Hampel spike rejection, then EMA
+ * Cycles per filter_update(): still to be measured on the bench, which
+ * reports them as "bench filter_update" (make run FILTER=<stage> in bench/).
+ */ 
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <inttypes.h>
+
+#define FILTER_BOXCAR	0
+#define FILTER_EMA		1
+#define FILTER_CIC		2
+#define FILTER_HAMPEL	3
+
+#ifndef FILTER_TYPE
+#define FILTER_TYPE FILTER_BOXCAR
+#endif
+
+// Moving average constants
+#define TOT_SAMPLES 32
+#define MOVAVG_SHIFT 5
+
+// Exponential moving average, time constant ~2^EMA_SHIFT samples
+#define EMA_SHIFT 4
+
+// Cascaded integrator-comb, gain CIC_DECIM^CIC_ORDER must be a power of 2
+#define CIC_ORDER 2
+#define CIC_DECIM_SHIFT 3
+#define CIC_DECIM (1 << CIC_DECIM_SHIFT)
+#define CIC_SHIFT 6		// log2(CIC_DECIM^CIC_ORDER)
+
+// Hampel window (odd) and threshold: samples further than
+// HAMPEL_K * MAD (+ HAMPEL_MIN LSB) from the window median are replaced by it
+#define HAMPEL_N 5
+#define HAMPEL_K 3
+#define HAMPEL_MIN 2
+
+#if FILTER_TYPE == FILTER_BOXCAR
+// Moving average structure
+typedef struct{
+	int8_t    samIdx;		// -1 until the first sample
+	uint32_t sum;
+	uint16_t samples[TOT_SAMPLES];
+}filter_t;
+
+#elif FILTER_TYPE == FILTER_EMA
+typedef struct{
+	uint8_t  seeded;	// 0 until the first sample
+	uint32_t acc;		// output << EMA_SHIFT
+}filter_t;
+
+#elif FILTER_TYPE == FILTER_CIC
+typedef struct{
+	uint32_t integ[CIC_ORDER];
+	uint32_t comb[CIC_ORDER];	// previous comb inputs
+	uint8_t  phase;
+	uint8_t  seeded;	// 0 until the first sample
+	uint16_t out;
+}filter_t;
+
+#elif FILTER_TYPE == FILTER_HAMPEL
+typedef struct{
+	uint16_t window[HAMPEL_N];
+	int8_t   idx;		// -1 until the first sample
+	uint32_t acc;		// EMA after the spike rejector
+}filter_t;
+
+#else
+#error "unknown FILTER_TYPE"
+#endif
+
+uint16_t filter_update(filter_t *, uint16_t);
+void filter_init(filter_t *);
+
+#endif //FILTER_H
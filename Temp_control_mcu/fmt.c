@@ -0,0 +1,94 @@
+/*
+ * fmt.c
+ *
+ * Fixed-width number formatting by subtract-and-compare
+ */ 
+#include <avr/pgmspace.h>
+
+#include "fmt.h"
+
+// Powers of ten below the top digit of a 16-bit value, largest first
+static const uint16_t pow10[FMT_U16_WIDTH - 1] PROGMEM = { 10000, 1000, 100, 10 };
+
+// Digits of a 16-bit value, at least 1
+static uint8_t u16_len(uint16_t v)
+{
+	uint8_t n = 1;
+	
+	while (n < FMT_U16_WIDTH && v >= pgm_read_word(&pow10[FMT_U16_WIDTH - 1 - n])) n++;
+	return n;
+}
+
+// n digits of v (n >= its length) at p, returns the position after them
+static char *put_u16(char *p, uint16_t v, uint8_t n)
+{
+	const uint16_t *pw;
+	uint16_t d;
+	char c;
+	
+	for (pw = &pow10[FMT_U16_WIDTH - n]; pw < &pow10[FMT_U16_WIDTH - 1]; pw++) {
+		d = pgm_read_word(pw);
+		for (c = '0'; v >= d; c++) v -= d;
+		*p++ = c;
+	}
+	*p++ = '0' + v;
+	return p;
+}
+
+// width - len spaces, or the whole field of '*' when len does not fit.
+// Returns 0 in the second case, nothing left to write.
+static uint8_t pad(char **p, uint8_t len, uint8_t width)
+{
+	char fill = len > width ? '*' : ' ';
+	uint8_t n = len > width ? width : width - len;
+	
+	while (n--) *(*p)++ = fill;
+	return len <= width;
+}
+
+/*
+** Functions
+*/
+
+// 0..255, the byte fast path needs no 16-bit compares
+char *fmt_u8(char *dst, uint8_t v, uint8_t width)
+{
+	uint8_t len = v >= 100 ? 3 : v >= 10 ? 2 : 1;
+	char c;
+	
+	if (!pad(&dst, len, width)) return dst;
+	if (len == 3) {
+		for (c = '0'; v >= 100; c++) v -= 100;
+		*dst++ = c;
+	}
+	if (len >= 2) {
+		for (c = '0'; v >= 10; c++) v -= 10;
+		*dst++ = c;
+	}
+	*dst++ = '0' + v;
+	return dst;
+}
+
+char *fmt_u16(char *dst, uint16_t v, uint8_t width)
+{
+	uint8_t len = u16_len(v);
+	
+	if (!pad(&dst, len, width)) return dst;
+	return put_u16(dst, v, len);
+}
+
+// v / 10 '.' v % 10 with a '-' in front of negative values, 5 -> 0.5
+char *fmt_tenths(char *dst, int16_t v, uint8_t width)
+{
+	uint16_t m = v < 0 ? -(uint16_t)v : (uint16_t)v;
+	uint8_t n = u16_len(m);
+	
+	if (n < 2) n = 2;
+	if (!pad(&dst, n + 1 + (v < 0), width)) return dst;
+	if (v < 0) *dst++ = '-';
+	dst = put_u16(dst, m, n);
+	// move the tenths digit right for the point
+	dst[0] = dst[-1];
+	dst[-1] = '.';
+	return dst + 1;
+}
@@ -0,0 +1,29 @@
+/*
+ * fmt.h
+ *
+ * Fixed-width decimal fields for the display, without itoa(). Each call
+ * writes exactly width characters right-aligned and padded with spaces
+ * into the caller's buffer (no terminating 0) and returns the position
+ * after the field, so it can write straight into lcd_buf_field(). Digits
+ * come from repeated subtraction of the powers of ten, there is no
+ * division on the way. A value with more characters than width fills the
+ * field with '*'.
+ *
+ *   fmt_u8      0..255: menu values, percentages
+ *   fmt_u16     0..65535: counters, byte counts
+ *   fmt_tenths  signed 0.1 units as [-]d.d: temperatures
+ */ 
+#ifndef FMT_H
+#define FMT_H
+
+#include <inttypes.h>
+
+#define FMT_U8_WIDTH		3		// widest fmt_u8() value
+#define FMT_U16_WIDTH		5
+#define FMT_TENTHS_WIDTH	7		// -3276.8
+
+char *fmt_u8(char *dst, uint8_t v, uint8_t width);
+char *fmt_u16(char *dst, uint16_t v, uint8_t width);
+char *fmt_tenths(char *dst, int16_t v, uint8_t width);
+
+#endif //FMT_H
@@ -0,0 +1,84 @@
+/*
+ * hal.h
+ *
+ * Thin hardware abstraction for the application modules: output pins, keys,
+ * the fan PWM, the Timer0 tick, the ADC, the LCD nibble bus, the
+ * USART and the EEPROM.
+ * The AVR backend in hal_avr.h is all static inline register access, building
+ * with HAL_SIM links the same modules against the host simulator in sim/.
+ * Interrupt handlers keep the avr-libc ISR() names in both builds.
+ */ 
+#ifndef HAL_H
+#define HAL_H
+
+#include <inttypes.h>
+
+// Outputs on PORTA, hal_out_set()/hal_out_clear() masks
+#define HAL_OUT_HEATER	(1 << 1)
+#define HAL_OUT_FAN		(1 << 2)	// fan enable, speed from hal_fan_pwm()
+#define HAL_OUT_ALARM	(1 << 3)
+#define HAL_OUT_ALL		(HAL_OUT_HEATER | HAL_OUT_FAN | HAL_OUT_ALARM)
+
+// Keys on PINB0..2 and the mode button on PD2 (active low),
+// hal_keys() returns them active high
+#define HAL_KEY1		(1 << 0)
+#define HAL_KEY2		(1 << 1)
+#define HAL_KEY3		(1 << 2)
+#define HAL_KEY_ALL		(HAL_KEY1 | HAL_KEY2 | HAL_KEY3)	// PORTB pins
+#define HAL_KEY_MODE	(1 << 3)
+
+// Timer0 CTC tick: F_CPU / 1024 / (HAL_TICK_OCR + 1) = ~98.6 Hz,
+// hal_tick_stretch() makes one period up to HAL_TICK_STRETCH_MAX ticks long
+#define HAL_TICK_OCR	72
+#define HAL_TICK_STRETCH_MAX	3	// (HAL_TICK_OCR + 1) * n - 1 <= 255
+#define HAL_TICK_COUNT_HZ	7200	// Timer0 counts/s, 7372800 / 1024
+#define HAL_TICK_PRESCALE	1024	// CPU cycles per Timer0 count
+
+// Timestamps count the 8-bit fan PWM timer (clk/8), one unit is 8 CPU cycles,
+// 8 / 7.3728 MHz ~= 139 / 128 us (0.1% high), no overflow below 2^24 units
+#define HAL_STAMP_CYCLES	8
+#define HAL_STAMP_US(units)	(((uint32_t)(units) * 139) >> 7)
+
+// EEPROM size in bytes
+#define HAL_EEPROM_SIZE	512
+
+// USART 8N1 divisor, 7.3728 MHz / 16 / baud - 1 is exact for 9600..230400
+#define HAL_UART_UBRR(baud)	(7372800UL / 16 / (baud) - 1)
+
+#ifdef HAL_SIM
+
+void hal_init();
+void hal_out_set(uint8_t mask);
+void hal_out_clear(uint8_t mask);
+uint8_t hal_keys();
+void hal_fan_pwm(uint8_t duty);
+void hal_idle(uint8_t sleep);
+void hal_tick_stretch(uint8_t n);
+uint16_t hal_tick_elapsed();
+uint8_t hal_tick_advance(uint8_t counts);
+void hal_stamp_init();
+uint8_t hal_stamp_timer(uint8_t *ovf);
+
+void hal_adc_init(uint8_t prescaler, uint8_t freeRun);
+void hal_adc_mux(uint8_t ch);
+uint16_t hal_adc_result();
+void hal_adc_start();
+
+void hal_lcd_init(uint8_t tickOcr);
+void hal_lcd_nibble(uint8_t nibble, uint8_t rs);
+void hal_lcd_tick(uint8_t on);
+
+void hal_uart_init(uint16_t ubrr);
+void hal_uart_tx_irq(uint8_t on);
+void hal_uart_tx(uint8_t byte);
+uint8_t hal_uart_rx();
+
+uint8_t hal_eeprom_read(uint16_t addr);
+void hal_eeprom_write(uint16_t addr, uint8_t byte);
+void hal_eeprom_irq(uint8_t on);
+
+#else
+#include "hal_avr.h"
+#endif
+
+#endif //HAL_H
@@ -0,0 +1,254 @@
+/*
+ * hal_avr.h
+ *
+ * ATmega16 backend of hal.h, only included from there
+ */ 
+#ifndef HAL_AVR_H
+#define HAL_AVR_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "lcd.h"
+
+#define HAL_ADC_REF (_BV(REFS0) | _BV(REFS1))	// 2.56V reference voltage
+#define HAL_DDR(x) (*(&x - 1))					// data direction register of port x
+
+// Ports, fan PWM on OC1B and the Timer0 tick
+static inline void hal_init()
+{
+	DDRA = HAL_OUT_ALL;
+	PORTA = 0x00;
+
+	PORTB = HAL_KEY_ALL;	// pull-ups
+	DDRB = 0;
+
+	DDRD = _BV(4);
+
+	// 8-bit fast PWM, clk/8
+	TCCR1A = _BV(COM1B1) | _BV(WGM10);
+	TCCR1B = _BV(WGM12) | _BV(CS11);
+	OCR1B = 0;
+
+	// CTC, clk/1024
+	TCCR0 = _BV(WGM01) | _BV(CS02) | _BV(CS00);
+	OCR0 = HAL_TICK_OCR;
+
+	TIMSK = _BV(OCIE0);
+}
+
+static inline void hal_out_set(uint8_t mask)
+{
+	PORTA |= mask;
+}
+
+static inline void hal_out_clear(uint8_t mask)
+{
+	PORTA &= ~mask;
+}
+
+static inline uint8_t hal_keys()
+{
+	return (~PINB & HAL_KEY_ALL) | (PIND & _BV(PD2) ? 0 : HAL_KEY_MODE);
+}
+
+static inline void hal_fan_pwm(uint8_t duty)
+{
+	OCR1B = duty;
+}
+
+// End of a main loop pass, called with interrupts off. With sleep set the
+// CPU waits in Idle mode for the next interrupt, timers, USART and ADC keep
+// running. Returns with interrupts on.
+static inline void hal_idle(uint8_t sleep)
+{
+	if (sleep) {
+		set_sleep_mode(SLEEP_MODE_IDLE);
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+	sei();
+}
+
+// Length of the running Timer0 period in ticks, 1..HAL_TICK_STRETCH_MAX.
+// Call from the compare interrupt, TCNT0 has just restarted from 0.
+static inline void hal_tick_stretch(uint8_t n)
+{
+	OCR0 = (HAL_TICK_OCR + 1) * n - 1;
+}
+
+// Timer0 counts since the compare match last handled by the interrupt,
+// a pending match adds the whole period. Call with interrupts off.
+static inline uint16_t hal_tick_elapsed()
+{
+	uint8_t t = TCNT0;
+	
+	if ((TIFR & _BV(OCF0)) && t < (OCR0 >> 1)) return t + OCR0 + 1;
+	return t;
+}
+
+// Move Timer0 on by up to counts, stopping short of the compare match
+// because a TCNT0 write blocks the match on the next timer clock. Returns
+// the counts taken. Call with interrupts off.
+static inline uint8_t hal_tick_advance(uint8_t counts)
+{
+	uint8_t t = TCNT0;
+	uint8_t room = t < OCR0 ? OCR0 - 1 - t : 0;
+	
+	if (counts > room) counts = room;
+	TCNT0 = t + counts;
+	return counts;
+}
+
+// Timer1 overflow interrupt on, the handler extends the count
+static inline void hal_stamp_init()
+{
+	TIMSK |= _BV(TOIE1);
+}
+
+// Timer1 count, *ovf is set when an overflow is pending that the count
+// already includes. Call with interrupts off.
+static inline uint8_t hal_stamp_timer(uint8_t *ovf)
+{
+	uint8_t t = TCNT1L;
+	
+	*ovf = (TIFR & _BV(TOV1)) && t < 0x80;
+	return t;
+}
+
+// Free running, or single conversions started by entering ADC Noise Reduction sleep
+static inline void hal_adc_init(uint8_t prescaler, uint8_t freeRun)
+{
+	if (freeRun) {
+		//free running trigger source
+		SFIOR &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));
+		//adc enable, auto trigger, interrupt, start first conversion
+		ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | prescaler;
+	} else {
+		//adc enable, interrupt, conversions are started by entering sleep
+		ADCSRA = _BV(ADEN) | _BV(ADIE) | prescaler;
+	}
+}
+
+// Takes effect with the next conversion
+static inline void hal_adc_mux(uint8_t ch)
+{
+	ADMUX = HAL_ADC_REF | ch;
+}
+
+static inline uint16_t hal_adc_result()
+{
+	return ADCW;
+}
+
+// Single conversion outside ADC Noise Reduction sleep
+static inline void hal_adc_start()
+{
+	ADCSRA |= _BV(ADSC);
+}
+
+// LCD lines as outputs, Timer2 in CTC mode at clk/8 with the interrupt off
+static inline void hal_lcd_init(uint8_t tickOcr)
+{
+	LCD_RS_PORT &= ~_BV(LCD_RS_PIN);
+	LCD_RW_PORT &= ~_BV(LCD_RW_PIN);
+	LCD_E_PORT &= ~_BV(LCD_E_PIN);
+	HAL_DDR(LCD_RS_PORT) |= _BV(LCD_RS_PIN);
+	HAL_DDR(LCD_RW_PORT) |= _BV(LCD_RW_PIN);
+	HAL_DDR(LCD_E_PORT) |= _BV(LCD_E_PIN);
+	HAL_DDR(LCD_DATA0_PORT) |= _BV(LCD_DATA0_PIN);
+	HAL_DDR(LCD_DATA1_PORT) |= _BV(LCD_DATA1_PIN);
+	HAL_DDR(LCD_DATA2_PORT) |= _BV(LCD_DATA2_PIN);
+	HAL_DDR(LCD_DATA3_PORT) |= _BV(LCD_DATA3_PIN);
+
+	TCCR2 = _BV(WGM21) | _BV(CS21);
+	OCR2 = tickOcr;
+}
+
+// Put RS and one nibble on the bus (RW low) and strobe E
+static inline void hal_lcd_nibble(uint8_t nibble, uint8_t rs)
+{
+	if (rs) LCD_RS_PORT |= _BV(LCD_RS_PIN);
+	else LCD_RS_PORT &= ~_BV(LCD_RS_PIN);
+	LCD_RW_PORT &= ~_BV(LCD_RW_PIN);
+
+	if (nibble & 0x08) LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
+	else LCD_DATA3_PORT &= ~_BV(LCD_DATA3_PIN);
+	if (nibble & 0x04) LCD_DATA2_PORT |= _BV(LCD_DATA2_PIN);
+	else LCD_DATA2_PORT &= ~_BV(LCD_DATA2_PIN);
+	if (nibble & 0x02) LCD_DATA1_PORT |= _BV(LCD_DATA1_PIN);
+	else LCD_DATA1_PORT &= ~_BV(LCD_DATA1_PIN);
+	if (nibble & 0x01) LCD_DATA0_PORT |= _BV(LCD_DATA0_PIN);
+	else LCD_DATA0_PORT &= ~_BV(LCD_DATA0_PIN);
+
+	LCD_E_PORT |= _BV(LCD_E_PIN);
+	__asm__ __volatile__( "rjmp 1f\n 1:" );		// E high for 500 ns
+	LCD_E_PORT &= ~_BV(LCD_E_PIN);
+}
+
+// Timer2 compare interrupt on/off, drives the LCD transmit queue
+static inline void hal_lcd_tick(uint8_t on)
+{
+	if (on) TIMSK |= _BV(OCIE2);
+	else TIMSK &= ~_BV(OCIE2);
+}
+
+// Transmitter on TXD (PD1), receiver on RXD (PD0) with its interrupt,
+// UDRE interrupt off
+static inline void hal_uart_init(uint16_t ubrr)
+{
+	UBRRH = ubrr >> 8;
+	UBRRL = ubrr;
+	UCSRC = _BV(URSEL) | _BV(UCSZ1) | _BV(UCSZ0);
+	UCSRB = _BV(RXCIE) | _BV(RXEN) | _BV(TXEN);
+}
+
+// Data register empty interrupt on/off, drives the transmit ring
+static inline void hal_uart_tx_irq(uint8_t on)
+{
+	if (on) UCSRB |= _BV(UDRIE);
+	else UCSRB &= ~_BV(UDRIE);
+}
+
+// Call only with UDRE set
+static inline void hal_uart_tx(uint8_t byte)
+{
+	UDR = byte;
+}
+
+// Reading clears RXC
+static inline uint8_t hal_uart_rx()
+{
+	return UDR;
+}
+
+// Waits for a running write to finish
+static inline uint8_t hal_eeprom_read(uint16_t addr)
+{
+	loop_until_bit_is_clear(EECR, EEWE);
+	EEAR = addr;
+	EECR |= _BV(EERE);
+	return EEDR;
+}
+
+// Start a write (~8.5 ms). Call with EEWE clear and interrupts off, EEWE
+// has to follow EEMWE within 4 cycles.
+static inline void hal_eeprom_write(uint16_t addr, uint8_t byte)
+{
+	EEAR = addr;
+	EEDR = byte;
+	EECR |= _BV(EEMWE);
+	EECR |= _BV(EEWE);
+}
+
+// EEPROM ready interrupt on/off, fires as long as no write is running
+static inline void hal_eeprom_irq(uint8_t on)
+{
+	if (on) EECR |= _BV(EERIE);
+	else EECR &= ~_BV(EERIE);
+}
+
+#endif //HAL_AVR_H
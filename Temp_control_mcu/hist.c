@@ -0,0 +1,211 @@
+/*
+ * hist.c
+ *
+ * Delta/varint coded history ring with a streaming export
+ */ 
+#include <util/atomic.h>
+
+#include "hal.h"
+#include "hist.h"
+#include "telem.h"
+
+#if HIST_SIZE > 256 || (HIST_SIZE & (HIST_SIZE - 1))
+#error "HIST_SIZE must be a power of 2 up to 256"
+#endif
+#if HIST_DATA_MAX + 2 > TELEM_MAX_PAYLOAD
+#error "HIST_DATA_MAX does not fit a telemetry frame"
+#endif
+
+#define HIST_MASK (HIST_SIZE - 1)
+
+// Timer0 ticks per record, Timer0 runs at 7372800 / 1024 = 7200 counts/s
+#define HIST_TICKS ((uint16_t)(HIST_PERIOD_S * 7200UL / (HAL_TICK_OCR + 1)))
+
+// Ring of varint records, oldest at tail
+static uint8_t ring[HIST_SIZE];
+static uint8_t head = 0;
+static uint8_t tail = 0;
+static uint16_t used = 0;			// bytes
+static uint16_t records = 0;
+static int16_t base = 0;			// mean before the oldest record
+static int16_t last = 0;			// mean of the newest record
+static uint8_t started = 0;			// base and last set by the first record
+
+// Running period, the tick counter is Timer0 only
+static volatile uint16_t ticks = 0;
+static volatile uint8_t due = 0;
+static int32_t sum = 0;
+static uint16_t count = 0;
+static uint8_t flagsSeen = 0;
+
+// Records held back while an export runs
+static uint8_t held = 0;
+static int16_t heldMean[HIST_HELD];
+static uint8_t heldFlags[HIST_HELD];
+static uint16_t lost = 0;
+
+// Export snapshot and progress
+static uint8_t exporting = 0;
+static uint8_t headSent;
+static uint8_t expStart;
+static uint16_t expBytes;
+static uint16_t expSent;
+
+// Byte of the export snapshot, the ring does not change while it runs
+static uint8_t snap(uint16_t pos)
+{
+	return ring[(expStart + pos) & HIST_MASK];
+}
+
+// Drop the oldest record and fold its delta into base
+static void drop_oldest()
+{
+	uint32_t v = 0;
+	uint8_t b, shift = 0;
+	
+	do {
+		b = ring[tail];
+		tail = (tail + 1) & HIST_MASK;
+		used--;
+		v |= (uint32_t)(b & 0x7F) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	
+	v >>= HIST_FLAG_BITS;
+	base += (int16_t)((v >> 1) ^ -(v & 1));
+	records--;
+}
+
+static void append(int16_t mean, uint8_t flags)
+{
+	uint8_t buf[3], n = 0;
+	int16_t d;
+	uint32_t v;
+	
+	if (!started) {
+		started = 1;
+		base = last = mean;
+	}
+	d = mean - last;
+	last = mean;
+	v = ((uint32_t)(uint16_t)((d << 1) ^ (d >> 15)) << HIST_FLAG_BITS) | flags;
+	
+	do {
+		buf[n] = v & 0x7F;
+		v >>= 7;
+		if (v) buf[n] |= 0x80;
+		n++;
+	} while (v);
+	
+	while (HIST_SIZE - used < n) drop_oldest();
+	for (uint8_t i = 0; i < n; i++) {
+		ring[head] = buf[i];
+		head = (head + 1) & HIST_MASK;
+	}
+	used += n;
+	records++;
+}
+
+/*
+** Functions
+*/
+
+void hist_init()
+{
+	head = tail = 0;
+	used = records = 0;
+	started = 0;
+	held = 0;
+	lost = 0;
+	sum = 0;
+	count = 0;
+	flagsSeen = 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ticks = 0;
+		due = 0;
+	}
+}
+
+// Call from the Timer0 ISR
+void hist_tick()
+{
+	if (++ticks >= HIST_TICKS) {
+		ticks = 0;
+		due = 1;
+	}
+}
+
+// Feed a temperature in 0.1 C and HIST_F_* output flags, every control
+// period. Closes the record when one is due.
+void hist_add(int16_t temp, uint8_t flags)
+{
+	int16_t mean;
+	
+	sum += temp;
+	count++;
+	flagsSeen |= flags;
+	if (!due) return;
+	due = 0;
+	
+	mean = (sum + (sum >= 0 ? count / 2 : -(count / 2))) / count;
+	if (!exporting) append(mean, flagsSeen);
+	else if (held < HIST_HELD) {
+		heldMean[held] = mean;
+		heldFlags[held] = flagsSeen;
+		held++;
+	} else lost++;
+	sum = 0;
+	count = 0;
+	flagsSeen = 0;
+}
+
+// Start streaming a snapshot of the ring, returns the number of records.
+// A running export starts over.
+uint16_t hist_export()
+{
+	exporting = 1;
+	headSent = 0;
+	expStart = tail;
+	expBytes = used;
+	expSent = 0;
+	return records;
+}
+
+// Call from the main loop, sends export frames while the TX ring has room
+void hist_poll()
+{
+	uint8_t n, i;
+	uint16_t age;
+	
+	if (!exporting) return;
+	
+	if (!headSent) {
+		if (!telem_fits(HIST_HEAD_LEN)) return;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			age = ticks;
+		}
+		telem_begin(TELEM_HIST_HEAD, HIST_HEAD_LEN);
+		telem_put16(base);
+		telem_put16(records);
+		telem_put16(expBytes);
+		telem_put16(HIST_PERIOD_S);
+		telem_put16((uint32_t)age * (HAL_TICK_OCR + 1) / 7200);
+		telem_put16(lost);
+		telem_end();
+		headSent = 1;
+	}
+	
+	while (expSent < expBytes) {
+		n = expBytes - expSent > HIST_DATA_MAX ? HIST_DATA_MAX : expBytes - expSent;
+		if (!telem_fits(n + 2)) return;
+		telem_begin(TELEM_HIST_DATA, n + 2);
+		telem_put16(expSent);
+		for (i = 0; i < n; i++) telem_put8(snap(expSent + i));
+		telem_end();
+		expSent += n;
+	}
+	
+	exporting = 0;
+	for (i = 0; i < held; i++) append(heldMean[i], heldFlags[i]);
+	held = 0;
+}
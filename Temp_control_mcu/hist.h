@@ -0,0 +1,47 @@
+/*
+ * hist.h
+ *
+ * Temperature and output history in a byte ring. Every HIST_PERIOD_S the
+ * mean of the temperatures passed to hist_add() and the outputs seen in that
+ * time become one record: zigzag(delta to the previous mean) << 3 | flags as
+ * a LEB128 varint, one byte while the mean moves by 0.7 C or less. When the
+ * ring is full the oldest records are dropped and folded into the base value.
+ * hist_export() streams the ring as telemetry frames from hist_poll(),
+ * records falling due meanwhile wait until the export is done, up to
+ * HIST_HELD of them, further ones are lost and counted.
+ *
+ * TELEM_HIST_HEAD payload (hist_export() snapshot):
+ *   int16  base, 0.1 C: the first record's delta applies to this
+ *   uint16 records in the ring
+ *   uint16 bytes in the ring, sent in TELEM_HIST_DATA frames
+ *   uint16 record period, s
+ *   uint16 age of the newest record, s
+ *   uint16 records lost since reset because an export ran too long
+ * TELEM_HIST_DATA payload:
+ *   uint16 offset of the first byte, then up to HIST_DATA_MAX ring bytes
+ */ 
+#ifndef HIST_H
+#define HIST_H
+
+#include <inttypes.h>
+
+#define HIST_SIZE		256		// bytes, power of 2, at most 256
+#define HIST_PERIOD_S	60		// ~4 h in 256 bytes while the room is steady
+#define HIST_DATA_MAX	24		// ring bytes per TELEM_HIST_DATA frame
+#define HIST_HELD		4		// records held back during an export, ~4 min
+
+// Record flags, set when the output was on at any time in the period
+#define HIST_F_HEATER	(1 << 0)
+#define HIST_F_FAN		(1 << 1)
+#define HIST_F_ALARM	(1 << 2)
+#define HIST_FLAG_BITS	3
+
+#define HIST_HEAD_LEN	12
+
+void hist_init();
+void hist_tick();
+void hist_add(int16_t temp, uint8_t flags);
+uint16_t hist_export();
+void hist_poll();
+
+#endif //HIST_H
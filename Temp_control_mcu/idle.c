@@ -0,0 +1,70 @@
+/*
+ * idle.c
+ *
+ * Idle sleep at the end of the main loop and its statistics
+ */ 
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "hal.h"
+#include "idle.h"
+
+// Timer0 counts up to the last handled compare match, Timer0 ISR only
+static volatile uint16_t base = 0;
+static uint16_t window = 0;
+
+// Current window, written by the main loop with interrupts off
+static volatile uint16_t wakeups = 0;
+static volatile uint16_t asleep = 0;		// Timer0 counts
+
+// Last complete window
+static volatile uint16_t lastWakeups = 0;
+static volatile uint8_t lastAsleep = 0;		// percent
+
+// End of a main loop pass, called with interrupts off, returns with them on.
+// With sleep set the CPU sleeps until the next interrupt.
+void idle_pass(uint8_t sleep)
+{
+	uint16_t start;
+	
+	if (!sleep) {
+		hal_idle(0);
+		return;
+	}
+	start = base + hal_tick_elapsed();
+	hal_idle(1);
+	cli();
+	asleep += base + hal_tick_elapsed() - start;
+	wakeups++;
+	sei();
+}
+
+// Timer0 interrupt, counts is the length of the period that just ended
+void idle_tick(uint8_t counts)
+{
+	base += counts;
+	window += counts;
+	if (window < IDLE_WINDOW_COUNTS) return;
+	lastWakeups = (uint32_t)wakeups * HAL_TICK_COUNT_HZ / window;
+	lastAsleep = (uint32_t)asleep * 100 / window;
+	window = 0;
+	wakeups = 0;
+	asleep = 0;
+}
+
+// Wakeups from idle sleep per second, last window
+uint16_t idle_wakeups()
+{
+	uint16_t n;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		n = lastWakeups;
+	}
+	return n;
+}
+
+// Percent of the last window spent in idle sleep
+uint8_t idle_asleep()
+{
+	return lastAsleep;
+}
@@ -0,0 +1,23 @@
+/*
+ * idle.h
+ *
+ * Main loop idle. A pass that leaves nothing due ends in Idle sleep until
+ * the next interrupt (Timer0, the LCD queue, the USART, the ADC round or an
+ * EEPROM write). Wakeups and the time asleep are counted in Timer0 counts
+ * (1024 cycles, ~139 us) and latched every IDLE_WINDOW_COUNTS for
+ * idle_wakeups() and idle_asleep(). Time in the ADC Noise Reduction sleep
+ * stops Timer0 as well and is not counted either way.
+ */ 
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <inttypes.h>
+
+#define IDLE_WINDOW_COUNTS	7200	// Timer0 counts per statistics window, ~1 s
+
+void idle_pass(uint8_t sleep);
+void idle_tick(uint8_t counts);
+uint16_t idle_wakeups();
+uint8_t idle_asleep();
+
+#endif //IDLE_H
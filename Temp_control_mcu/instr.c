@@ -0,0 +1,145 @@
+/*
+ * instr.c
+ *
+ * Section timing statistics for the instrumentation build
+ */ 
+#include "instr.h"
+
+#if INSTRUMENT
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+
+const char instr_names[INSTR_NUM][5] PROGMEM = { "tick", "keys", "loop" };
+
+static volatile uint16_t stampHi;
+static instrStat_t stats[INSTR_NUM];
+
+ISR(TIMER1_OVF_vect) {
+	stampHi++;
+}
+
+// 24-bit timestamp in HAL_STAMP_CYCLES units, interrupts off
+static uint32_t stamp()
+{
+	uint8_t ovf;
+	uint8_t lo = hal_stamp_timer(&ovf);
+	
+	return ((uint32_t)(uint16_t)(stampHi + ovf) << 8) | lo;
+}
+
+void instr_init()
+{
+	instr_reset();
+	hal_stamp_init();
+}
+
+void instr_begin(uint8_t id)
+{
+	instrStat_t *s = &stats[id];
+	uint32_t now, per;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		now = stamp();
+		if (s->count) {
+			per = (now - s->start) & 0xFFFFFF;
+			if (per < s->perMin) s->perMin = per;
+			if (per > s->perMax) s->perMax = per;
+		}
+		s->start = now;
+	}
+}
+
+void instr_end(uint8_t id)
+{
+	instrStat_t *s = &stats[id];
+	uint32_t d;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		d = (stamp() - s->start) & 0xFFFFFF;
+		if (d < s->min) s->min = d;
+		if (d > s->max) s->max = d;
+		if (s->count) s->avg += d - (s->avg >> 4);
+		else s->avg = d << 4;
+		if (s->count != 0xFFFF) s->count++;
+	}
+}
+
+// Copy of one section, consistent against the ISRs
+void instr_get(uint8_t id, instrStat_t *stat)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*stat = stats[id];
+		stat->avg >>= 4;
+	}
+}
+
+void instr_reset()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (uint8_t i = 0; i < INSTR_NUM; i++) {
+			stats[i].count = 0;
+			stats[i].min = 0xFFFFFF;
+			stats[i].max = 0;
+			stats[i].avg = 0;
+			stats[i].perMin = 0xFFFFFF;
+			stats[i].perMax = 0;
+		}
+	}
+}
+
+// Timestamp units to microseconds
+uint32_t instr_us(uint32_t units)
+{
+	return HAL_STAMP_US(units);
+}
+
+// Dump line n of INSTR_LINES, INSTR_FIELDS per section, times in us:
+// "<name> n <count>", "<name> min|avg|max <us>", "<name> per <us>-<us>".
+// Writes at most INSTR_LINE_MAX characters and a terminator to buf,
+// returns the length, 0 for the fields a section has no data for yet.
+uint8_t instr_line(uint8_t n, char *buf)
+{
+	static const char fields[INSTR_FIELDS][6] PROGMEM = { " n ", " min ", " avg ", " max ", " per " };
+	uint8_t field = n % INSTR_FIELDS;
+	instrStat_t s;
+	uint32_t v;
+	char *p = buf;
+	
+	instr_get(n / INSTR_FIELDS, &s);
+	if ((field != 0 && !s.count) || (field == 4 && s.count < 2)) return 0;
+	switch (field) {
+		case 0: v = s.count; break;
+		case 1: v = instr_us(s.min); break;
+		case 2: v = instr_us(s.avg); break;
+		case 3: v = instr_us(s.max); break;
+		default: v = instr_us(s.perMin); break;
+	}
+	strcpy_P(p, instr_names[n / INSTR_FIELDS]);
+	strcat_P(p, fields[field]);
+	p += strlen(p);
+	ultoa(v, p, 10);
+	if (field == 4) {
+		p += strlen(p);
+		*p++ = '-';
+		ultoa(instr_us(s.perMax), p, 10);
+	}
+	return strlen(buf);
+}
+
+// All dump lines, each ended by '\n'
+void instr_dump(void (*out)(char))
+{
+	char line[INSTR_LINE_MAX + 1];
+	
+	for (uint8_t i = 0; i < INSTR_LINES; i++) {
+		if (!instr_line(i, line)) continue;
+		for (char *p = line; *p; p++) out(*p);
+		out('\n');
+	}
+}
+#endif
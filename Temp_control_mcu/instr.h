@@ -0,0 +1,62 @@
+/*
+ * instr.h
+ *
+ * Optional timing instrumentation. With INSTRUMENT set, INSTR_BEGIN() and
+ * INSTR_END() timestamp a section from the fan PWM timer extended by its
+ * overflow interrupt (8 cycles per unit, ~18 s range) and keep per-section
+ * statistics: count, min/avg/max duration and the spread of the period
+ * between entries (jitter). Costs ~90 bytes RAM and a Timer1 overflow
+ * interrupt every 2048 cycles (~1.5% CPU); without it the macros are empty.
+ */ 
+#ifndef INSTR_H
+#define INSTR_H
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+#ifndef INSTRUMENT
+#define INSTRUMENT 0
+#endif
+
+// Instrumented sections
+#define INSTR_TICK	0		// TIMER0_COMP_vect
+#define INSTR_KEYS	1		// key press handling in the main loop
+#define INSTR_LOOP	2		// main loop body
+#define INSTR_NUM	3
+
+// instr_line(): count, min, avg, max and period per section, the longest
+// line is "loop per 18204444-18204444" (24-bit stamps in us)
+#define INSTR_FIELDS	5
+#define INSTR_LINES		(INSTR_NUM * INSTR_FIELDS)
+#define INSTR_LINE_MAX	26
+
+extern const char instr_names[INSTR_NUM][5] PROGMEM;
+
+typedef struct{
+	uint16_t count;
+	uint32_t min;
+	uint32_t max;
+	uint32_t avg;		// EMA of the duration, 1/16 weight, scaled by 16
+	uint32_t start;		// timestamp of the last entry
+	uint32_t perMin;	// shortest and longest time between entries
+	uint32_t perMax;
+}instrStat_t;
+
+#if INSTRUMENT
+#define INSTR_BEGIN(id) instr_begin(id)
+#define INSTR_END(id) instr_end(id)
+#else
+#define INSTR_BEGIN(id)
+#define INSTR_END(id)
+#endif
+
+void instr_init();
+void instr_begin(uint8_t id);
+void instr_end(uint8_t id);
+void instr_get(uint8_t id, instrStat_t *stat);
+void instr_reset();
+uint32_t instr_us(uint32_t units);
+uint8_t instr_line(uint8_t n, char *buf);
+void instr_dump(void (*out)(char));
+
+#endif //INSTR_H
@@ -0,0 +1,104 @@
+/*
+ * keys.c
+ *
+ * Tick-driven key debouncing with an event queue
+ */ 
+#include <util/atomic.h>
+
+#include "hal.h"
+#include "keys.h"
+
+#if KEYS_QUEUE_SIZE & (KEYS_QUEUE_SIZE - 1)
+#error "KEYS_QUEUE_SIZE must be a power of 2"
+#endif
+
+#define KEYS_QUEUE_MASK (KEYS_QUEUE_SIZE - 1)
+
+// Debounce state, keys_tick() only
+static uint8_t integ[KEYS_NUM];
+static uint8_t held[KEYS_NUM];		// ticks since the press, stops at 0xFF
+static uint8_t repeatIn[KEYS_NUM];	// ticks to the next repeat
+static uint8_t repeats[KEYS_NUM];	// repeats since the press, stops at the fastest step
+static volatile uint8_t state = 0;	// debounced keys, bit per index
+
+// Event queue written by keys_tick() (head) and read by the main loop (tail),
+// a full queue drops new events
+static uint8_t queue[KEYS_QUEUE_SIZE];
+static volatile uint8_t head = 0;
+static volatile uint8_t tail = 0;
+
+static void push(uint8_t ev)
+{
+	uint8_t next = (head + 1) & KEYS_QUEUE_MASK;
+	
+	if (next == tail) return;
+	queue[head] = ev;
+	head = next;
+}
+
+void keys_init()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (uint8_t i = 0; i < KEYS_NUM; i++) integ[i] = 0;
+		state = 0;
+		head = tail = 0;
+	}
+}
+
+// Call once per tick with interrupts off (Timer0 ISR)
+void keys_tick()
+{
+	uint8_t i, bit, raw = hal_keys();
+	
+	for (i = 0, bit = 1; i < KEYS_NUM; i++, bit <<= 1) {
+		if (raw & bit) {
+			if (integ[i] < KEYS_DEBOUNCE_TICKS) integ[i]++;
+		} else if (integ[i]) integ[i]--;
+		
+		if (!(state & bit)) {
+			if (integ[i] == KEYS_DEBOUNCE_TICKS) {
+				state |= bit;
+				held[i] = 0;
+				repeatIn[i] = KEYS_REPEAT_DELAY_TICKS;
+				repeats[i] = 0;
+				push(KEYS_PRESS | i);
+			}
+		} else if (!integ[i]) {
+			state &= ~bit;
+			push((held[i] < KEYS_LONG_TICKS ? KEYS_SHORT : KEYS_RELEASE) | i);
+		} else {
+			if (held[i] != 0xFF && ++held[i] == KEYS_LONG_TICKS) push(KEYS_LONG | i);
+			if (!--repeatIn[i]) {
+				repeatIn[i] = KEYS_REPEAT_TICKS;
+				if (repeats[i] <= 2 * KEYS_ACCEL_REPEATS) repeats[i]++;
+				push((repeats[i] <= KEYS_ACCEL_REPEATS ? KEYS_REPEAT :
+					repeats[i] <= 2 * KEYS_ACCEL_REPEATS ? KEYS_REPEAT_5 : KEYS_REPEAT_10) | i);
+			}
+		}
+	}
+}
+
+// Pop the oldest event, returns 0 when there is none
+uint8_t keys_get(uint8_t *ev)
+{
+	uint8_t t = tail;
+	
+	if (t == head) return 0;
+	*ev = queue[t];
+	tail = (t + 1) & KEYS_QUEUE_MASK;
+	return 1;
+}
+
+// Events wait in the queue
+uint8_t keys_pending()
+{
+	return head != tail;
+}
+
+// No key down or bouncing, the scan can slow down. Timer0 ISR only.
+uint8_t keys_idle()
+{
+	for (uint8_t i = 0; i < KEYS_NUM; i++)
+		if (integ[i]) return 0;
+	return 1;
+}
@@ -0,0 +1,56 @@
+/*
+ * keys.h
+ *
+ * Key scanner run from the Timer0 tick (~10 ms) for key1..3 on PINB0..2
+ * and the mode button on PD2. Each key has an integrator that counts
+ * up while the pin reads pressed and down while it reads released, the
+ * debounced state flips at either end. Press, release, long-press and
+ * auto-repeat events go into a queue that the main loop drains with
+ * keys_get(), a release before the long-press is a KEYS_SHORT. A held
+ * key repeats after KEYS_REPEAT_DELAY_TICKS, every KEYS_REPEAT_TICKS,
+ * and the repeats speed up the value steps from 1 to 5 to 10 every
+ * KEYS_ACCEL_REPEATS repeats.
+ */ 
+#ifndef KEYS_H
+#define KEYS_H
+
+#include <inttypes.h>
+
+// Key indexes, same order as the hal_keys() bits
+#define KEYS_KEY1		0
+#define KEYS_KEY2		1
+#define KEYS_KEY3		2
+#define KEYS_MODE		3
+#define KEYS_NUM		4
+
+// Timing in Timer0 ticks, 100 ticks ~ 1 s
+#define KEYS_DEBOUNCE_TICKS	3		// integrator range, ~30 ms
+#define KEYS_LONG_TICKS		99		// held this long for KEYS_LONG, < 255
+#define KEYS_REPEAT_DELAY_TICKS	50	// first repeat, ~0.5 s
+#define KEYS_REPEAT_TICKS	15		// then every ~150 ms
+#define KEYS_ACCEL_REPEATS	10		// repeats per step size, 1 -> 5 -> 10
+
+#define KEYS_QUEUE_SIZE	8		// events, power of 2
+
+// Events: key index in the low nibble, type in the high nibble
+#define KEYS_PRESS		0x00
+#define KEYS_SHORT		0x10	// released before KEYS_LONG
+#define KEYS_RELEASE	0x20	// released after KEYS_LONG
+#define KEYS_LONG		0x30
+#define KEYS_REPEAT		0x40	// held key, step 1
+#define KEYS_REPEAT_5	0x50	// after KEYS_ACCEL_REPEATS repeats, step 5
+#define KEYS_REPEAT_10	0x60	// after 2 * KEYS_ACCEL_REPEATS repeats, step 10
+#define KEYS_ID(ev)		((ev) & 0x0F)
+#define KEYS_TYPE(ev)	((ev) & 0xF0)
+
+// Value step of a press or repeat event: 1, 5 or 10
+#define KEYS_STEP(ev)	(KEYS_TYPE(ev) == KEYS_REPEAT_10 ? 10 : KEYS_TYPE(ev) == KEYS_REPEAT_5 ? 5 : 1)
+#define KEYS_IS_REPEAT(ev)	(KEYS_TYPE(ev) >= KEYS_REPEAT)
+
+void keys_init();
+void keys_tick();
+uint8_t keys_get(uint8_t *ev);
+uint8_t keys_pending();
+uint8_t keys_idle();
+
+#endif //KEYS_H
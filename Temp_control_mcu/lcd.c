@@ -24,8 +24,11 @@
 *****************************************************************************/
 #include <inttypes.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <string.h>
 #include "lcd.h"
+#include "hal.h"
 
 
 
@@ -66,6 +69,29 @@
 #endif
 #endif
 
+#if LCD_ASYNC
+#if !LCD_IO_MODE
+#error "asynchronous transmit queue requires 4-bit IO port mode"
+#endif
+#else
+#ifdef HAL_SIM
+#error "host simulation build requires LCD_ASYNC"
+#endif
+#endif
+
+#if LCD_ASYNC
+#if LCD_QUEUE_SIZE & (LCD_QUEUE_SIZE-1)
+#error "LCD_QUEUE_SIZE must be a power of 2"
+#endif
+/* Timer2 compare value for one tick of LCD_TICK_US, clk/8, rounded up */
+#define LCD_TICK_OCR    ((((XTAL/8)/1000)*LCD_TICK_US + 999)/1000 - 1)
+/* ticks to wait after clear display / return home (1.52ms) */
+#define LCD_CLR_TICKS   ((1640 + LCD_TICK_US - 1)/LCD_TICK_US)
+#define lcd_send(d,rs)  lcd_enqueue(d,rs)
+#else
+#define lcd_send(d,rs)  lcd_write(d,rs)
+#endif
+
 #if LCD_CONTROLLER_KS0073
 #if LCD_LINES==4
 
@@ -76,10 +102,36 @@
 #endif
 #endif
 
+/* 
+** shadow framebuffer: what the screen functions rendered and what the display shows
+*/
+static char lcd_shadow[LCD_LINES][LCD_DISP_LENGTH];
+static char lcd_shown[LCD_LINES][LCD_DISP_LENGTH];
+static uint8_t lcd_buf_x;
+static uint8_t lcd_buf_y;
+
+#if LCD_ASYNC
+/*
+** transmit queue: bytes with a parallel bitmap of RS flags, drained by TIMER2_COMP_vect
+*/
+static uint8_t lcd_q_data[LCD_QUEUE_SIZE];
+static uint8_t lcd_q_rs[LCD_QUEUE_SIZE/8];
+static volatile uint8_t lcd_q_head;
+static volatile uint8_t lcd_q_tail;
+static uint8_t lcd_q_hwm;
+static uint16_t lcd_q_dropped;
+static uint8_t lcd_addr;                  /* address counter after all queued bytes */
+
+/* Timer2 interrupt state: next nibble to send and remaining wait ticks */
+static uint8_t lcd_tx_low;
+static uint8_t lcd_tx_wait;
+#endif
+
+
 /* 
 ** function prototypes 
 */
-#if LCD_IO_MODE
+#if LCD_IO_MODE && LCD_ASYNC==0
 static void toggle_e(void);
 #endif
 
@@ -89,6 +141,10 @@ static void toggle_e(void);
 
 
 
+#ifdef HAL_SIM
+#include <util/delay.h>
+#define delay(us)  _delay_us(us)
+#else
 /*************************************************************************
  delay loop for small accurate delays: 16-bit counter, 4 cycles/loop
 *************************************************************************/
@@ -111,9 +167,10 @@ delay for a minimum of <us> microseconds
 the number of loops is calculated at compile-time from MCU clock frequency
 *************************************************************************/
 #define delay(us)  _delayFourCycles( ( ( 1*(XTAL/4000) )*us)/1000 )
+#endif
 
 
-#if LCD_IO_MODE
+#if LCD_IO_MODE && LCD_ASYNC==0
 /* toggle Enable Pin to initiate write */
 static void toggle_e(void)
 {
@@ -124,6 +181,83 @@ static void toggle_e(void)
 #endif
 
 
+#if LCD_ASYNC
+/*************************************************************************
+Append byte to the transmit queue and start the Timer2 interrupt.
+Bytes are dropped and counted when the queue is full.
+Input:    data   byte to write to LCD
+          rs     1: write data    
+                 0: write instruction
+Returns:  none
+*************************************************************************/
+static void lcd_enqueue(uint8_t data, uint8_t rs)
+{
+    uint8_t head = lcd_q_head;
+    uint8_t next = (head + 1) & (LCD_QUEUE_SIZE - 1);
+    uint8_t used;
+
+
+    if (next == lcd_q_tail) {
+        lcd_q_dropped++;
+        return;
+    }
+    lcd_q_data[head] = data;
+    if (rs)
+        lcd_q_rs[head >> 3] |= _BV(head & 7);
+    else
+        lcd_q_rs[head >> 3] &= ~_BV(head & 7);
+    lcd_q_head = next;
+    hal_lcd_tick(1);
+
+    used = (next - lcd_q_tail) & (LCD_QUEUE_SIZE - 1);
+    if (used > lcd_q_hwm) lcd_q_hwm = used;
+
+    /* follow the address counter so lcd_putc() can handle '\n' without reading it back */
+    if (rs)
+        lcd_addr++;
+    else if (data & (1<<LCD_DDRAM))
+        lcd_addr = data & ~(1<<LCD_DDRAM);
+    else if (data && data < (1<<LCD_ENTRY_MODE))
+        lcd_addr = 0;                    /* clear display or return home */
+}
+
+
+/*************************************************************************
+Timer2 compare interrupt: one nibble per tick, high nibble first.
+RS is set up with the high nibble, after the low nibble the controller
+needs 37us (one tick) or 1.52ms for clear display / return home.
+*************************************************************************/
+ISR(TIMER2_COMP_vect)
+{
+    uint8_t tail, data, rs;
+
+
+    if (lcd_tx_wait) {
+        lcd_tx_wait--;
+        return;
+    }
+    tail = lcd_q_tail;
+    if (tail == lcd_q_head) {
+        hal_lcd_tick(0);                 /* queue empty, stop until next lcd_enqueue() */
+        return;
+    }
+    data = lcd_q_data[tail];
+    rs = lcd_q_rs[tail >> 3] & _BV(tail & 7);
+
+    if (!lcd_tx_low) {
+        hal_lcd_nibble(data >> 4, rs);
+        lcd_tx_low = 1;
+    } else {
+        hal_lcd_nibble(data, rs);
+        lcd_tx_low = 0;
+        if (!rs && data && data < (1<<LCD_ENTRY_MODE))
+            lcd_tx_wait = LCD_CLR_TICKS;
+        lcd_q_tail = (tail + 1) & (LCD_QUEUE_SIZE - 1);
+    }
+}
+#endif
+
+
 /*************************************************************************
 Low-level function to write byte to LCD controller
 Input:    data   byte to write to LCD
@@ -131,7 +265,7 @@ Input:    data   byte to write to LCD
                  0: write instruction
 Returns:  none
 *************************************************************************/
-#if LCD_IO_MODE
+#if LCD_IO_MODE && LCD_ASYNC==0
 static void lcd_write(uint8_t data,uint8_t rs) 
 {
     unsigned char dataBits ;
@@ -199,7 +333,7 @@ static void lcd_write(uint8_t data,uint8_t rs)
         LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
     }
 }
-#else
+#elif !LCD_IO_MODE
 #define lcd_write(d,rs) if (rs) *(volatile uint8_t*)(LCD_IO_DATA) = d; else *(volatile uint8_t*)(LCD_IO_FUNCTION) = d;
 /* rs==0 -> write instruction to LCD_IO_FUNCTION */
 /* rs==1 -> write data to LCD_IO_DATA */
@@ -212,6 +346,7 @@ Input:    rs     1: read data
                  0: read busy flag / address counter
 Returns:  byte read from LCD controller
 *************************************************************************/
+#if LCD_ASYNC==0
 #if LCD_IO_MODE
 static uint8_t lcd_read(uint8_t rs) 
 {
@@ -297,6 +432,7 @@ static uint8_t lcd_waitbusy(void)
     return (lcd_read(0));  // return address counter
     
 }/* lcd_waitbusy */
+#endif
 
 
 /*************************************************************************
@@ -354,8 +490,12 @@ Returns: none
 *************************************************************************/
 void lcd_command(uint8_t cmd)
 {
+#if LCD_ASYNC
+    lcd_enqueue(cmd,0);
+#else
     lcd_waitbusy();
     lcd_write(cmd,0);
+#endif
 }
 
 
@@ -366,8 +506,12 @@ Returns: none
 *************************************************************************/
 void lcd_data(uint8_t data)
 {
+#if LCD_ASYNC
+    lcd_enqueue(data,1);
+#else
     lcd_waitbusy();
     lcd_write(data,1);
+#endif
 }
 
 
@@ -407,7 +551,11 @@ void lcd_gotoxy(uint8_t x, uint8_t y)
 *************************************************************************/
 int lcd_getxy(void)
 {
+#if LCD_ASYNC
+    return lcd_addr;
+#else
     return lcd_waitbusy();
+#endif
 }
 
 
@@ -439,7 +587,11 @@ void lcd_putc(char c)
     uint8_t pos;
 
 
+#if LCD_ASYNC
+    pos = lcd_addr;         // address counter once the queue has drained
+#else
     pos = lcd_waitbusy();   // read busy-flag and address counter
+#endif
     if (c=='\n')
     {
         lcd_newline(pos);
@@ -449,28 +601,30 @@ void lcd_putc(char c)
 #if LCD_WRAP_LINES==1
 #if LCD_LINES==1
         if ( pos == LCD_START_LINE1+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE1,0);
+            lcd_send((1<<LCD_DDRAM)+LCD_START_LINE1,0);
         }
 #elif LCD_LINES==2
         if ( pos == LCD_START_LINE1+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
+            lcd_send((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
         }else if ( pos == LCD_START_LINE2+LCD_DISP_LENGTH ){
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE1,0);
+            lcd_send((1<<LCD_DDRAM)+LCD_START_LINE1,0);
         }
 #elif LCD_LINES==4
         if ( pos == LCD_START_LINE1+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
+            lcd_send((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
         }else if ( pos == LCD_START_LINE2+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE3,0);
+            lcd_send((1<<LCD_DDRAM)+LCD_START_LINE3,0);
         }else if ( pos == LCD_START_LINE3+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE4,0);
+            lcd_send((1<<LCD_DDRAM)+LCD_START_LINE4,0);
         }else if ( pos == LCD_START_LINE4+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE1,0);
+            lcd_send((1<<LCD_DDRAM)+LCD_START_LINE1,0);
         }
 #endif
+#if LCD_ASYNC==0
         lcd_waitbusy();
 #endif
-        lcd_write(c, 1);
+#endif
+        lcd_send(c, 1);
     }
 
 }/* lcd_putc */
@@ -510,6 +664,184 @@ void lcd_puts_p(const char *progmem_s)
 }/* lcd_puts_p */
 
 
+/*************************************************************************
+Clear the shadow framebuffer and set its cursor to home position
+*************************************************************************/
+void lcd_buf_clear(void)
+{
+    memset(lcd_shadow, ' ', sizeof(lcd_shadow));
+    lcd_buf_x = 0;
+    lcd_buf_y = 0;
+
+}/* lcd_buf_clear */
+
+
+/*************************************************************************
+Set shadow framebuffer cursor to specified position
+Input:    x  horizontal position  (0: left most position)
+          y  vertical position    (0: first line)
+Returns:  none
+*************************************************************************/
+void lcd_buf_gotoxy(uint8_t x, uint8_t y)
+{
+    lcd_buf_x = x;
+    lcd_buf_y = y;
+
+}/* lcd_buf_gotoxy */
+
+
+/*************************************************************************
+Put character into the shadow framebuffer at its cursor position
+Input:    character to be displayed
+Returns:  none
+*************************************************************************/
+void lcd_buf_putc(char c)
+{
+    if (c=='\n')
+    {
+        lcd_buf_x = 0;
+        if (++lcd_buf_y >= LCD_LINES) lcd_buf_y = 0;
+        return;
+    }
+    if (lcd_buf_x >= LCD_DISP_LENGTH)
+    {
+#if LCD_WRAP_LINES==1
+        lcd_buf_x = 0;
+        if (++lcd_buf_y >= LCD_LINES) lcd_buf_y = 0;
+#else
+        return;
+#endif
+    }
+    if (lcd_buf_y < LCD_LINES)
+        lcd_shadow[lcd_buf_y][lcd_buf_x] = c;
+    lcd_buf_x++;
+
+}/* lcd_buf_putc */
+
+
+/*************************************************************************
+Put string into the shadow framebuffer
+Input:    string to be displayed
+Returns:  none
+*************************************************************************/
+void lcd_buf_puts(const char *s)
+{
+    register char c;
+
+    while ( (c = *s++) ) {
+        lcd_buf_putc(c);
+    }
+
+}/* lcd_buf_puts */
+
+
+/*************************************************************************
+Put string from program memory into the shadow framebuffer
+Input:     string from program memory to be displayed
+Returns:   none
+*************************************************************************/
+void lcd_buf_puts_p(const char *progmem_s)
+{
+    register char c;
+
+    while ( (c = pgm_read_byte(progmem_s++)) ) {
+        lcd_buf_putc(c);
+    }
+
+}/* lcd_buf_puts_p */
+
+
+/*************************************************************************
+Reserve width cells at the shadow framebuffer cursor for the caller to fill
+and move the cursor past them. A field that would run past the end of the
+line is moved left to end in the last column.
+Input:    width  cells, at most LCD_DISP_LENGTH
+Returns:  first cell of the field
+*************************************************************************/
+char *lcd_buf_field(uint8_t width)
+{
+    char *p;
+
+    if (lcd_buf_x > LCD_DISP_LENGTH - width) lcd_buf_x = LCD_DISP_LENGTH - width;
+    if (lcd_buf_y >= LCD_LINES) lcd_buf_y = LCD_LINES - 1;
+    p = &lcd_shadow[lcd_buf_y][lcd_buf_x];
+    lcd_buf_x += width;
+    return p;
+
+}/* lcd_buf_field */
+
+
+/*************************************************************************
+Send the cells of the shadow framebuffer that differ from the display.
+A cursor move costs one instruction byte, so gaps of up to LCD_BUF_SKIP
+unchanged cells are cheaper to rewrite than to jump over.
+Returns:  0 when the display matches the shadow framebuffer
+          1 when the transmit queue is full, call again to send the rest
+*************************************************************************/
+uint8_t lcd_flush(void)
+{
+    uint8_t x, y, cx;
+
+
+    for (y = 0; y < LCD_LINES; y++)
+    {
+        cx = 0xFF;                          /* display cursor not on this line */
+        for (x = 0; x < LCD_DISP_LENGTH; x++)
+        {
+            if (lcd_shadow[y][x] == lcd_shown[y][x]) continue;
+#if LCD_ASYNC
+            if (lcd_queue_free() < LCD_BUF_SKIP + 2) return 1;
+#endif
+
+            if (cx > x || x - cx > LCD_BUF_SKIP) {
+                lcd_gotoxy(x, y);
+                cx = x;
+            }
+            while (cx <= x) {
+                lcd_data(lcd_shadow[y][cx]);
+                lcd_shown[y][cx] = lcd_shadow[y][cx];
+                cx++;
+            }
+        }
+    }
+    return 0;
+
+}/* lcd_flush */
+
+
+#if LCD_ASYNC
+/*************************************************************************
+Return number of bytes that can be queued without dropping
+*************************************************************************/
+uint8_t lcd_queue_free(void)
+{
+    return (lcd_q_tail - lcd_q_head - 1) & (LCD_QUEUE_SIZE - 1);
+
+}/* lcd_queue_free */
+
+
+/*************************************************************************
+Return transmit queue high-water mark and number of dropped bytes
+*************************************************************************/
+void lcd_queue_stats(uint8_t *hwm, uint16_t *dropped)
+{
+    *hwm = lcd_q_hwm;
+    *dropped = lcd_q_dropped;
+
+}/* lcd_queue_stats */
+#endif
+
+
+/*************************************************************************
+Forget what the display shows so the next lcd_flush() redraws every cell
+*************************************************************************/
+void lcd_buf_invalidate(void)
+{
+    memset(lcd_shown, 0xFF, sizeof(lcd_shown));
+
+}/* lcd_buf_invalidate */
+
+
 /*************************************************************************
 Initialize display and select type of cursor 
 Input:    dispAttr LCD_DISP_OFF            display off
@@ -520,7 +852,31 @@ Returns:  none
 *************************************************************************/
 void lcd_init(uint8_t dispAttr)
 {
-#if LCD_IO_MODE
+#if LCD_ASYNC
+    /*
+     *  Initialize LCD to 4 bit I/O mode through the HAL, Timer2 stays off until the first lcd_enqueue()
+     */
+    hal_lcd_init(LCD_TICK_OCR);
+    delay(16000);        /* wait 16ms or more after power-on       */
+
+    /* initial write to lcd is 8bit */
+    hal_lcd_nibble((LCD_FUNCTION_8BIT_1LINE)>>4, 0);
+    delay(4992);         /* delay, busy flag can't be checked here */
+
+    /* repeat last command */
+    hal_lcd_nibble((LCD_FUNCTION_8BIT_1LINE)>>4, 0);
+    delay(64);           /* delay, busy flag can't be checked here */
+
+    /* repeat last command a third time */
+    hal_lcd_nibble((LCD_FUNCTION_8BIT_1LINE)>>4, 0);
+    delay(64);           /* delay, busy flag can't be checked here */
+
+    /* now configure for 4bit mode */
+    hal_lcd_nibble((LCD_FUNCTION_4BIT_1LINE)>>4, 0);
+    delay(64);           /* some displays need this additional delay */
+
+    /* from now commands are queued, Timer2 in CTC mode clocks them out */
+#elif LCD_IO_MODE
     /*
      *  Initialize LCD to 4 bit I/O mode
      */
@@ -606,4 +962,8 @@ void lcd_init(uint8_t dispAttr)
     lcd_command(LCD_MODE_DEFAULT);          /* set entry mode               */
     lcd_command(dispAttr);                  /* display/cursor control       */
 
+    /* display is blank now, start the shadow framebuffer the same way */
+    lcd_buf_clear();
+    memset(lcd_shown, ' ', sizeof(lcd_shown));
+
 }/* lcd_init */
@@ -67,6 +67,26 @@
 #define LCD_WRAP_LINES      0     /**< 0: no wrap, 1: wrap at end of visibile line */
 
 
+/**
+ *  @name Definitions for the shadow framebuffer
+ *  Screens are rendered into a RAM copy of the display with the lcd_buf_*() functions,
+ *  lcd_flush() then sends only the cells that differ from what the display shows.
+ */
+#define LCD_BUF_SKIP        1     /**< max. unchanged cells rewritten instead of moving the cursor */
+
+
+/**
+ *  @name Definitions for the asynchronous transmit queue
+ *  With LCD_ASYNC set, lcd_command(), lcd_data(), lcd_putc(), lcd_puts() and lcd_gotoxy()
+ *  only append to a ring buffer and return. The Timer2 compare interrupt clocks the bytes
+ *  out one nibble per tick and the busy flag is never polled (4-bit IO port mode only).
+ *  Interrupts must be enabled before lcd_init().
+ */
+#define LCD_ASYNC           1     /**< 0: wait for busy flag, 1: queue bytes for the Timer2 interrupt */
+#define LCD_QUEUE_SIZE     64     /**< size of transmit queue in bytes, power of 2 */
+#define LCD_TICK_US        40     /**< Timer2 period in us, at least the 37us command execution time */
+
+
 #define LCD_IO_MODE      1         /**< 0: memory mapped mode, 1: IO port mode */
 #if LCD_IO_MODE
 /**
@@ -256,6 +276,101 @@ extern void lcd_command(uint8_t cmd);
 extern void lcd_data(uint8_t data);
 
 
+/**
+ @brief    Clear the shadow framebuffer and set its cursor to home position
+ @param    void
+ @return   none
+*/
+extern void lcd_buf_clear(void);
+
+
+/**
+ @brief    Set shadow framebuffer cursor to specified position
+
+ @param    x horizontal position\n (0: left most position)
+ @param    y vertical position\n   (0: first line)
+ @return   none
+*/
+extern void lcd_buf_gotoxy(uint8_t x, uint8_t y);
+
+
+/**
+ @brief    Put character into the shadow framebuffer at its cursor position
+ 
+ Characters past the end of a line are dropped unless LCD_WRAP_LINES is set.
+ @param    c character to be displayed, '\n' moves to the start of the next line
+ @return   none
+*/
+extern void lcd_buf_putc(char c);
+
+
+/**
+ @brief    Put string into the shadow framebuffer
+ @param    s string to be displayed
+ @return   none
+*/
+extern void lcd_buf_puts(const char *s);
+
+
+/**
+ @brief    Put string from program memory into the shadow framebuffer
+ @param    progmem_s string from program memory to be displayed
+ @return   none
+*/
+extern void lcd_buf_puts_p(const char *progmem_s);
+
+
+/**
+ @brief    Reserve cells at the shadow framebuffer cursor and move the cursor past them
+ 
+ The caller writes exactly width characters to the returned cells, e.g. with the
+ fmt_*() functions. A field that would run past the end of the line is moved left
+ so it ends in the last column.
+ @param    width number of cells, at most LCD_DISP_LENGTH
+ @return   first cell of the field
+*/
+extern char *lcd_buf_field(uint8_t width);
+
+
+/**
+ @brief    Send the cells of the shadow framebuffer that differ from the display
+ 
+ Consecutive changed cells are written with a single cursor move, gaps of up to
+ LCD_BUF_SKIP unchanged cells are rewritten instead of moving the cursor.
+ @param    void
+ @return   0 when the display matches the shadow framebuffer, 1 when the transmit
+           queue filled up and lcd_flush() has to be called again
+*/
+extern uint8_t lcd_flush(void);
+
+
+/**
+ @brief    Number of bytes that can be queued without dropping (LCD_ASYNC only)
+ @param    void
+ @return   free bytes in the transmit queue
+*/
+extern uint8_t lcd_queue_free(void);
+
+
+/**
+ @brief    Transmit queue statistics (LCD_ASYNC only)
+ @param    hwm     most bytes ever waiting in the queue
+ @param    dropped bytes lost because the queue was full
+ @return   none
+*/
+extern void lcd_queue_stats(uint8_t *hwm, uint16_t *dropped);
+
+
+/**
+ @brief    Forget what the display shows so the next lcd_flush() redraws every cell
+ 
+ Use after writing to the display directly, e.g. with lcd_clrscr() or lcd_puts().
+ @param    void
+ @return   none
+*/
+extern void lcd_buf_invalidate(void);
+
+
 /**
  @brief macros for automatically storing string constant in program memory
 */
@@ -2,151 +2,148 @@
  * Temp_control_mcu.c
  *
  * Created: 23.3.2021. 22:44:18
- * Author : Luka upanovi, Vedran Mati, Borna Sila
+ * Author : Luka upanoviæ, Vedran Matiæ, Borna Sila
  * Version: 1.0
  */ 
 #define F_CPU 7372800UL
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <util/delay.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include "hal.h"
+#include "config.h"
+#include "eeconf.h"
 #include "lcd.h"
+#include "adc.h"
+#include "sensor.h"
+#include "pid.h"
+#include "autotune.h"
+#include "tprop.h"
+#include "instr.h"
+#include "telem.h"
+#include "uart.h"
+#include "cmd.h"
+#include "hist.h"
+#include "keys.h"
+#include "menu.h"
+#include "stack.h"
+#include "idle.h"
+#include "sched.h"
+#include "fmt.h"
 
 /*
 ** Global variables
 */
-static uint8_t temp = 0;		// current temperature
+static int16_t tempTenths = 0;			// current temperature in 0.1 C
 static uint8_t pswSet = 0;
 static uint8_t pswUse = 0;
 static uint8_t mAccess = 0;
 static uint8_t pswError = 0;
-static uint8_t update = 0;		// update after menu
 static uint8_t lock = 0;		// lock menu access 
-static char password[4];
 static char tmpPassword[4];
 
-// Names
-const char *mode[4];
-const char *menu[4];
-const char *variables[4];
-const char *alarms[5];
+// Variables, alarms, working mode and password are in config.h,
+// the menu and its names in menu.c. All of this state belongs to the
+// main loop, the interrupts only post events (sched.h).
 
-// Variables and alarms
-static uint8_t var_mat[4];
-static uint8_t alarms_mat[5];
-
-// Modes/menu
+// Modes/password entry
 static uint8_t dMode = 0;		// display mode
-static uint8_t mMode = 0;		// menu mode
-static uint8_t mVar = 0;		// menu variables
-static uint8_t mSelect = 0;		// menu select flag
-static uint8_t modeSelect = 0;	// working mode
-static uint8_t subMenu = 0;		// sub menu flag
-
-
-// Moving average constants
-#define TOT_SAMPLES 32
-#define MOVAVG_SHIFT 5
-#define SUM_DIFF_THOLD TOT_SAMPLES/2    // 1/2LSB
-
-// Moving average structure
-typedef struct{
-	int8_t    samIdx;
-	uint32_t sum;
-	uint16_t samples[TOT_SAMPLES];
-}movAvg_t;
-
-volatile uint8_t updateLCD;
-uint16_t curAvg;
-uint8_t curTemp;
-uint8_t halfCelsius;
+static uint8_t mVar = 0;		// password digit
+static uint8_t mSelect = 0;		// digit select flag
+
+
+// Display refresh, Timer0 ticks at ~98.6 Hz
+#define REFRESH_TICKS 10
+
+static uint8_t redraw = 1;				// screen state changed since last render
+static uint8_t refreshTicks = 0;
+static uint8_t lcdPending = 0;			// changed cells still waiting for queue space
+
+// Whole degrees (menu values) to tenths
+#define TENTHS(x) ((int16_t)(x) * 10)
+
+// Timer0 periods stretch to this many ticks while no key is down or
+// bouncing, ~33 Hz instead of ~98.6 Hz, the tick counters keep real time
+#if INSTRUMENT
+#define TICK_STRETCH 1		// keep the tick timing statistics meaningful
+#else
+#define TICK_STRETCH HAL_TICK_STRETCH_MAX
+#endif
+
+// Control, Timer0 ticks at ~98.6 Hz
+#define CONTROL_TICKS 50		// PID period, ~0.5 s
+
+static pidCtrl_t pid;
+static uint8_t controlTicks = 0;
+static uint8_t lastMode;				// working mode the PID limits were set for
+static autotune_t tune;
+static uint8_t tuneReturn = 2;			// working mode to go back to after autotune
+static int16_t ctrlOut = 0;				// last controller output, fan < 0 < heater
+static uint8_t alarmOn = 0;
+
+#if INSTRUMENT
+// Diagnostics screen (dMode 5), two pages per instrumented section,
+// then the stack page
+#define DIAG_PAGES (2 * INSTR_NUM + 1)
+static uint8_t diagPage = 0;
+#endif
 
 /*
 ** Functions
 */
 void showTemperature();
 void showMsg();
-void showMenu();
+void showDiag();
 
 void resetPsw(char *tmpPsw);
 void setPsw();
 void enterPsw();
 uint8_t checkPsw(const char *toCheck);
 
-uint16_t getMovAvg(uint16_t, movAvg_t *);
-uint16_t readAdc(uint8_t);
-
-void init_temp_ma(movAvg_t *, int8_t);
-void init_adc();
+void setup();
+void mainLoop();
+void handleEvent(uint8_t ev);
+void newSample();
+void control();
+void checkAlarm();
+void keyEvents();
+void sendStatus();
+void refreshLCD();
+uint8_t nothingDue();
 void init_spec_char();
-void nonBlockingDebounce();
-void writeOnLCD();
+void modePress();
+void keyPress(uint8_t keys, uint8_t step);
+void keyLong(uint8_t id);
+void pidMode(uint8_t mode);
+uint8_t editing();
+void digitStep(char *digit, int8_t dir);
+uint8_t writeOnLCD();
 
 int main(void)
 {
-	// Setting menu items
-	menu[0] = "Variables";
-	menu[1] = "Modes";
-	menu[2] = "Alarm";
-	
-	// Setting variables names
-	variables[0] = "max temp";
-	variables[1] = "min temp";
-	variables[2] = "set temp";
-	variables[3] = "temp diff";
-	
-	// Setting alarm names
-	alarms[0] = "alarm diff";
-	alarms[1] = "alarm high";
-	alarms[2] = "alarm low";
-	alarms[3] = "alarm usage";
-	alarms[4] = "lock usage";
-	
-	// Setting modes
-	mode[0] = "heat";
-	mode[1] = "cool";
-	mode[2] = "bal ";
-	
-	// Initialize password to '0000'
-	resetPsw(tmpPassword);
-	resetPsw(password);
+	setup();
 	
-	// Initializing default variables
-	var_mat[0] = 99;
-	var_mat[1] = 0;
-	var_mat[2] = 0;
-	var_mat[3] = 2;
-	
-	// Initializing default alarm
-	alarms_mat[0] = 2;
-	alarms_mat[1] = 50;
-	alarms_mat[2] = 0;
-	alarms_mat[3] = 0;
-	alarms_mat[4] = 0;
-
-	// PORT/DDR/registers setup
-	DDRA = _BV(1) | _BV(2) | _BV(3);
-	PORTA = 0x00;
-
-	PORTB = _BV(0) | _BV(1) | _BV(2);
-	DDRB = 0;
-
-	DDRD = _BV(4);
-
-	TCCR1A = _BV(COM1B1) | _BV(WGM10);
-	TCCR1B = _BV(WGM12) | _BV(CS11);
-	OCR1B = 128;
-
-	TCCR0 = _BV(WGM01) | _BV(CS02) | _BV(CS00);
-	OCR0 = 72;
-
-	TIMSK = _BV(OCIE0);
+	while (1) {
+		mainLoop();
+		cli();
+		idle_pass(nothingDue());
+	}
+}
 
-	MCUCR = _BV(ISC01);
-	GICR = _BV(INT0);
+// Menu defaults, hardware and peripheral initialization
+void setup()
+{
+	// Variables, alarms, mode, password, sensor calibration and PID gains
+	// from EEPROM, defaults (password '0000', not used) on a blank one
+	resetPsw(tmpPassword);
+	eeconf_load();
+	sensor_set_cal(config.calGain, config.calOffset);
+	
+	// Ports, fan PWM and Timer0 tick setup, keys are scanned on the tick
+	hal_init();
+	keys_init();
 	sei();
 	
 	// Initialize LCD and custom characters
@@ -156,278 +153,166 @@ int main(void)
 
 	writeOnLCD();
 	
-	uint16_t tmp;
-	uint32_t lastDisplayedSum = 0;
-	movAvg_t movingAverage;
+	// Start scanning the ADC channels
+	adc_init();
+	tprop_init();
+	
+	// Telemetry on the USART
+	telem_init();
+	hist_init();
 	
-	// Initialize moving average structure
-	init_temp_ma(&movingAverage, TOT_SAMPLES);
+	// Stored gains and the output range of the stored mode, an autotune
+	// cut short by a reset starts over and then goes to balance
+	pid_init(&pid);
+	pid.kp = config.kp;
+	pid.ki = config.ki;
+	pid.kd = config.kd;
+	pidMode(config.modeSelect < 3 ? config.modeSelect : 2);
 	
-	// Initialize ADC
-	init_adc();
+#if INSTRUMENT
+	instr_init();
+#endif
 	
 	sei();
+}
 
-	while (1) {
-		tmp = readAdc(0);
-		curAvg = getMovAvg(tmp, &movingAverage);
-		
-		if(abs(lastDisplayedSum - movingAverage.sum) > SUM_DIFF_THOLD ) {
-			lastDisplayedSum = movingAverage.sum;
-			updateLCD = 1;
-			update = 1;
-		}
-		
-		// update after change
-		if (update){
-			update = 0;
-			uint16_t diff = abs(var_mat[2] - temp);
-			
-			// modes update
-			if (diff > var_mat[3]){
-				switch (modeSelect) {
-					case 0:
-					if (temp > var_mat[2]) {
-						PORTA &= _BV(0);
-						lock = 0;
-						} else {
-						PORTA |=  _BV(1);
-						lock = 1;
-					}
-					break;
-					case 1:
-					if (temp < var_mat[2]) {
-						PORTA &= _BV(0);
-						lock = 0;
-						} else {
-						PORTA |=  _BV(2);
-						lock = 1;
-					}
-					break;
-					case 2:
-					lock = 1;
-					if (temp < var_mat[2]) {
-						PORTA |=  _BV(1);
-					} else PORTA |=  _BV(2);
-					break;
-				}
-				} else {
-				PORTA &= _BV(0) | _BV(3);
-				lock = 0;
-			}
-			
-			// alarm update
-			if (alarms_mat[3]){
-				if (diff > alarms_mat[0] || temp > alarms_mat[1] || temp < alarms_mat[2]){
-					PORTA |= _BV(3);
-				} else PORTA &= ~_BV(3);
-			}
-		}
-		
-		// Using keys (PORTB) to control
-		if (bit_is_clear(PINB, 0)) {
-			switch (dMode) {
-				case 1:
-				// key1 function on temp display screen
-				break;
-				case 2:
-				if (!subMenu) {
-					// switch between sub menus
-					mMode = (mMode + 1) % 3;
-					} else if (!mSelect) {
-					// change sub menu items 0 = var, 1 = mode, 2 = alarm
-					mVar = (mVar + 1) % (mMode == 0 ? 4 :  mMode == 1 ? 3 : 5);
-					// mode changes directly
-					if (mMode == 1) modeSelect = mVar;
-					
-					// variable setup
-					} else if (mMode == 0) {
-					var_mat[mVar] += 1;
-					switch (mVar) {
-						case 0:
-						if (var_mat[mVar] > 99) var_mat[mVar] = var_mat[1] + 1;
-						if (var_mat[2] > var_mat[mVar]) var_mat[2] = var_mat[mVar];
-						break;
-						case 1:
-						if (var_mat[mVar] >= var_mat[0]) var_mat[mVar] = 0;
-						if (var_mat[2] < var_mat[mVar]) var_mat[2] = var_mat[mVar];
-						break;
-						case 2:
-						if (var_mat[mVar] > var_mat[0]) var_mat[mVar] = var_mat[1];
-						break;
-						case 3:
-						if (var_mat[mVar] > 30) var_mat[mVar] = 0;
-						break;
-					}
-					
-					// alarm setup
-					} else if (mMode == 2) {
-					alarms_mat[mVar] += 1;
-					switch (mVar) {
-						case 0:
-						if (alarms_mat[mVar] > 50) alarms_mat[mVar] = 1;
-						break;
-						case 1:
-						if (alarms_mat[mVar] > 99) alarms_mat[mVar] = alarms_mat[2] + 1;
-						break;
-						case 2:
-						if (alarms_mat[mVar] >= alarms_mat[1]) alarms_mat[mVar] = 0;
-						break;
-						case 3:
-						alarms_mat[mVar] = alarms_mat[mVar] % 2;
-						break;
-						case 4:
-						alarms_mat[mVar] = alarms_mat[mVar] % 2;
-						break;
-					}
-				}
-				break;
-				case 3:
-				if (!mSelect) {
-					mVar = (mVar + 1) % 4;
-					} else {
-					password[mVar] += 1;
-				}
-				break;
-				case 4:
-				if (!mSelect) {
-					mVar = (mVar + 1) % 4;
-					} else {
-					tmpPassword[mVar] += 1;
-				}
-				break;
-			}
-			} else if (bit_is_clear(PINB, 1)) {
-			switch (dMode) {
-				case 1:
-				// // key2 function on temp display screen
-				break;
-				case 2:
-				if (!subMenu) {
-					subMenu = 1;
-					mVar = mMode == 1 ? modeSelect : 0;
-					} else if (!mSelect) {
-					mSelect = 1;
-					
-					// variable setup
-					} else if (mMode == 0) {
-					switch (mVar) {
-						case 0:
-						if (var_mat[mVar] <= var_mat[1]) var_mat[mVar] = 100;
-						if (var_mat[2] > var_mat[mVar]) var_mat[2] = var_mat[mVar] - 1;
-						break;
-						case 1:
-						if (var_mat[mVar] <= 0) var_mat[mVar] = var_mat[0];
-						if (var_mat[2] > var_mat[mVar]) var_mat[2] = var_mat[mVar] - 1;
-						break;
-						case 2:
-						if (var_mat[mVar] <= var_mat[1]) var_mat[mVar] = var_mat[0] + 1;
-						break;
-						case 3:
-						if (var_mat[mVar] <= 0) var_mat[mVar] = 31;
-						break;
-					}
-					var_mat[mVar] -= 1;
-					
-					// alarm setup
-					} else if (mMode == 2) {
-					switch (mVar) {
-						case 0:
-						if (alarms_mat[mVar] <= 1) alarms_mat[mVar] = 51;
-						break;
-						case 1:
-						if (alarms_mat[mVar] <= 0) alarms_mat[mVar] = 100;
-						break;
-						case 2:
-						if (alarms_mat[mVar] <= 0) alarms_mat[mVar] = 100;
-						break;
-						case 3:
-						alarms_mat[mVar] = (alarms_mat[mVar] + 1) % 2 + 1;
-						break;
-						case 4:
-						alarms_mat[mVar] = (alarms_mat[mVar] + 1) % 2 + 1;
-						break;
-					}
-					alarms_mat[mVar] -= 1;
-				}
-				break;
-				case 3:
-				if (!mSelect) {
-					mSelect = 1;
-					} else {
-					password[mVar] -= 1;
-				}
-				break;
-				case 4:
-				if (!mSelect) {
-					mSelect = 1;
-					} else {
-					tmpPassword[mVar] -= 1;
-				}
-				break;
-			}
-			} else if (bit_is_clear(PINB, 2)) {
-			switch (dMode) {
-				case 2:
-				if (mSelect){
-					mSelect = 0;
-					} else if (subMenu){
-					subMenu = 0;
-				}
-				break;
-				case 3:
-				if (!mSelect) {
-					pswSet = 1;
-					pswUse = !checkPsw("0000");
-					mAccess = !pswUse;
-					mVar = 0;
-					} else {
-					mSelect = 0;
-				}
-				break;
-				case 4:
-				if (mSelect) {
-					mSelect = 0;
-					} else if (checkPsw(tmpPassword)) {
-					mAccess = 1;
-					dMode = 2;
-					mVar = 1;
-					resetPsw(tmpPassword);
-					} else {
-					pswError = 1;
-					mAccess = 0;
-					mVar = 0;
-					resetPsw(tmpPassword);
-				}
-				break;
-			}
-		}
-
-		_delay_ms(200);
+// One pass: the background work, then every pending event by priority
+void mainLoop()
+{
+	uint8_t ev;
+	
+	INSTR_BEGIN(INSTR_LOOP);
+	
+	// Oversampled conversions in ADC Noise Reduction sleep when a round is due
+	adc_sample();
+	
+	// Remote configuration commands, replies go out between the frames
+	if (cmd_poll()) {
+		redraw = 1;
+		sched_post(SCHED_SAMPLE);
+		sched_post(SCHED_ALARM);
 	}
+	
+	// History export frames, between the other frames
+	hist_poll();
+	
+	// Save the configuration a while after the last edit
+	eeconf_poll();
+	
+	// Each handler runs to completion, events posted meanwhile are taken
+	// in priority order
+	while ((ev = sched_next()) != SCHED_NONE) handleEvent(ev);
+	
+	INSTR_END(INSTR_LOOP);
+}
+
+// Nothing for the next pass until an interrupt posts it, interrupts off.
+// Work that waits for LCD queue or TX ring space is woken by the draining
+// interrupt, or the next tick at the latest.
+uint8_t nothingDue() {
+	return !sched_pending() && !adc_due() && !uart_rx_ready();
 }
 
 /*
-** ISR
+** Event handlers
 */
 
-ISR(TIMER0_COMP_vect) {
-	writeOnLCD();
+void handleEvent(uint8_t ev) {
+	switch (ev) {
+		case SCHED_SAMPLE:
+		newSample();
+		break;
+		case SCHED_CONTROL:
+		control();
+		break;
+		case SCHED_ALARM:
+		checkAlarm();
+		break;
+		case SCHED_KEY:
+		keyEvents();
+		break;
+		case SCHED_TELEM:
+		sendStatus();
+		break;
+		case SCHED_REFRESH:
+		refreshLCD();
+		break;
+	}
+}
+
+// Filter all samples collected by ADC_vect, a new temperature is shown
+// and checked against the alarm limits. Also posted after a calibration
+// change.
+void newSample() {
+	int16_t temp;
 	
-	if(updateLCD == 1) {
-		uint32_t temperature;
+	adc_process();
+	temp = sensor_to_tenths(adc_get(ADC_CH_TEMP));
+	if (temp != tempTenths) {
+		tempTenths = temp;
+		redraw = 1;
+		sched_post(SCHED_ALARM);
+	}
+}
 
-		temperature = curAvg << 8;
-		temperature >>= 9;
-		halfCelsius = temperature & 1;
-		temperature >>= 1;
-		temp = temperature;
-		updateLCD = 0;
+// Alarm output from the temperature and the alarm settings
+void checkAlarm() {
+	int16_t temp = tempTenths;
+	uint16_t diff = abs(TENTHS(config.var_mat[2]) - temp);
+	
+	if (config.alarms_mat[3]){
+		if (diff > TENTHS(config.alarms_mat[0]) || temp > TENTHS(config.alarms_mat[1]) || temp < TENTHS(config.alarms_mat[2])){
+			hal_out_set(HAL_OUT_ALARM);
+			alarmOn = 1;
+		} else {
+			hal_out_clear(HAL_OUT_ALARM);
+			alarmOn = 0;
+		}
 	}
 }
 
-ISR(INT0_vect) {
+// Key events from the Timer0 scanner, presses, short and long presses
+// drive the screens, held key1/key2 repeat while a value is being edited
+void keyEvents() {
+	uint8_t ev;
 	
+	while (keys_get(&ev)) {
+		uint8_t id = KEYS_ID(ev);
+		uint8_t type = KEYS_TYPE(ev);
+		
+		if (type == KEYS_RELEASE || (KEYS_IS_REPEAT(ev) && !(id <= KEYS_KEY2 && editing()))) continue;
+		if (type == KEYS_SHORT && (dMode != 2 || id > KEYS_KEY2)) continue;
+		INSTR_BEGIN(INSTR_KEYS);
+		redraw = 1;
+		if (type == KEYS_SHORT) menu_short(_BV(id));
+		else if (type == KEYS_LONG) keyLong(id);
+		else if (id == KEYS_MODE) modePress();
+		else keyPress(_BV(id), KEYS_STEP(ev));
+		INSTR_END(INSTR_KEYS);
+	}
+}
+
+// Render stage, at most every REFRESH_TICKS and only after a change. Drawn
+// from the Timer0 tick this cost an estimated ~4.7 ms per tick, not measured
+// yet, see bench/ writeOnLCD_temp and TIMER0_COMP_vect.
+void refreshLCD() {
+#if INSTRUMENT
+	if (dMode == 5) redraw = 1;
+#endif
+	if (redraw) {
+		redraw = 0;
+		lcdPending = writeOnLCD();
+	} else if (lcdPending) {
+		lcdPending = lcd_flush();
+	}
+}
+
+/*
+** Key handling
+*/
+
+// Mode button press, switches between the screens
+void modePress() {
 	switch (dMode) {
 		// dMode 0 is only at the start
 		// Set up password
@@ -437,16 +322,15 @@ ISR(INT0_vect) {
 		
 		// Switch between main and menu display
 		case 1:
-		if (alarms_mat[4] & lock) break;
+		if (config.alarms_mat[4] & lock) break;
 		dMode = !mAccess ? 4 : 2;
 		break;
 		case 2:
 		dMode = 1;
 		mAccess = !pswUse;
-		mMode = 0;
 		mSelect = 0;
-		subMenu = 0;
-		update = 1;
+		menu_reset();
+		sched_post(SCHED_ALARM);
 		break;
 		
 		// After password go to main display
@@ -459,11 +343,173 @@ ISR(INT0_vect) {
 		pswError = 0;
 		dMode = 1;
 		break;
+		
+		// Exit diagnostics screen
+		case 5:
+		dMode = 1;
+		break;
 	}
+}
 
-	writeOnLCD();
+// Key held for ~1 s, after its press event. Key3 leaves the menu from
+// anywhere in it, like the mode button, key1 starts autotune on the
+// Modes page.
+void keyLong(uint8_t id) {
+	if (dMode != 2) return;
+	if (id == KEYS_KEY3) modePress();
+	else if (id <= KEYS_KEY2) menu_long(_BV(id));
+}
+
+// A value or password digit is selected for key1/key2 to change
+uint8_t editing() {
+	if (dMode == 2) return menu_editing();
+	return mSelect && (dMode == 3 || dMode == 4);
+}
+
+// Password digit '0'..'9' one up or down, wrapping around
+void digitStep(char *digit, int8_t dir) {
+	if (dir > 0) *digit = *digit >= '9' || *digit < '0' ? '0' : *digit + 1;
+	else *digit = *digit <= '0' || *digit > '9' ? '9' : *digit - 1;
+}
+
+// Key1..3 press or repeat, keys is a HAL_KEY* mask, step the change
+// of the edited value
+void keyPress(uint8_t keys, uint8_t step) {
+	if (dMode == 2) {
+		menu_key(keys, step);
+		return;
+	}
+	
+	if (keys & HAL_KEY1) {
+		switch (dMode) {
+			case 1:
+#if INSTRUMENT
+			// hidden diagnostics screen
+			dMode = 5;
+			diagPage = 0;
+#endif
+			break;
+			case 3:
+			if (!mSelect) {
+				mVar = (mVar + 1) % 4;
+				} else {
+				digitStep(&config.password[mVar], 1);
+			}
+			break;
+			case 4:
+			if (!mSelect) {
+				mVar = (mVar + 1) % 4;
+				} else {
+				digitStep(&tmpPassword[mVar], 1);
+			}
+			break;
+#if INSTRUMENT
+			case 5:
+			diagPage = (diagPage + 1) % DIAG_PAGES;
+			break;
+#endif
+		}
+		} else if (keys & HAL_KEY2) {
+		switch (dMode) {
+			case 1:
+			// // key2 function on temp display screen
+			break;
+			case 3:
+			if (!mSelect) {
+				mSelect = 1;
+				} else {
+				digitStep(&config.password[mVar], -1);
+			}
+			break;
+			case 4:
+			if (!mSelect) {
+				mSelect = 1;
+				} else {
+				digitStep(&tmpPassword[mVar], -1);
+			}
+			break;
+#if INSTRUMENT
+			case 5:
+			instr_reset();
+			break;
+#endif
+		}
+		} else if (keys & HAL_KEY3) {
+		switch (dMode) {
+			case 3:
+			if (!mSelect) {
+				pswSet = 1;
+				pswUse = !checkPsw("0000");
+				mAccess = !pswUse;
+				mVar = 0;
+				} else {
+				mSelect = 0;
+			}
+			break;
+			case 4:
+			if (mSelect) {
+				mSelect = 0;
+				} else if (checkPsw(tmpPassword)) {
+				mAccess = 1;
+				dMode = 2;
+				mVar = 1;
+				resetPsw(tmpPassword);
+				} else {
+				pswError = 1;
+				mAccess = 0;
+				mVar = 0;
+				resetPsw(tmpPassword);
+			}
+			break;
+		}
+	}
+}
+
+/*
+** ISR
+*/
 
-	nonBlockingDebounce();
+ISR(TIMER0_COMP_vect) {
+	static uint8_t ticks = 1;		// length of the period that just ended
+	uint8_t i;
+	
+	INSTR_BEGIN(INSTR_TICK);
+	
+	for (i = 0; i < ticks; i++) {
+		if (++refreshTicks >= REFRESH_TICKS) {
+			refreshTicks = 0;
+			sched_post(SCHED_REFRESH);
+		}
+		
+		if (++controlTicks >= CONTROL_TICKS) {
+			controlTicks = 0;
+			sched_post(SCHED_CONTROL);
+		}
+		
+		tprop_tick();
+		
+		adc_tick();
+		
+		telem_tick();
+		
+		uart_tick();
+		
+		eeconf_tick();
+		
+		hist_tick();
+	}
+	
+	// one sample per period, a key that starts bouncing brings the fast tick back
+	keys_tick();
+	if (keys_pending()) sched_post(SCHED_KEY);
+	
+	if (telem_due()) sched_post(SCHED_TELEM);
+	
+	idle_tick(ticks * (HAL_TICK_OCR + 1));
+	ticks = keys_idle() && tprop_idle(TICK_STRETCH) ? TICK_STRETCH : 1;
+	hal_tick_stretch(ticks);
+	
+	INSTR_END(INSTR_TICK);
 }
 
 /*
@@ -472,122 +518,96 @@ ISR(INT0_vect) {
 
 // Main display
 void showTemperature() {
-	lcd_clrscr();
-
-	char adcStr[16];
-	itoa(temp, adcStr, 10);
-	
-	lcd_puts("Temp: ");
-	lcd_puts(adcStr);
-	lcd_putc('.');
-	halfCelsius ? lcd_putc('5') : lcd_putc('0');
-	lcd_putc(223);        //degree symbol
-	lcd_puts("C  ");
-	lcd_gotoxy(0, 1);
-	lcd_puts("Mode: ");
-	lcd_puts(mode[modeSelect]);
-	lcd_gotoxy(11, 1);
-	if (alarms_mat[4]) lcd_putc(0); // lock icon
-	lcd_gotoxy(13, 1);
-	if (alarms_mat[3]) lcd_putc(1); // bell icon
+	lcd_buf_puts("Temp:");
+	fmt_tenths(lcd_buf_field(5), tempTenths, 5);
+	lcd_buf_putc(223);        //degree symbol
+	lcd_buf_putc('C');
+	lcd_buf_gotoxy(0, 1);
+	lcd_buf_puts("Mode: ");
+	lcd_buf_puts_p(menu_mode_name(config.modeSelect));
+	lcd_buf_gotoxy(11, 1);
+	if (config.alarms_mat[4]) lcd_buf_putc(0); // lock icon
+	lcd_buf_gotoxy(13, 1);
+	if (config.alarms_mat[3]) lcd_buf_putc(1); // bell icon
 }
 
 // Starting message
 void showMsg() {
-	lcd_clrscr();
-	lcd_gotoxy(3, 0);
-	lcd_puts("Welcome to");
-	lcd_gotoxy(1, 1);
-	lcd_puts("temp. control");
+	lcd_buf_gotoxy(3, 0);
+	lcd_buf_puts("Welcome to");
+	lcd_buf_gotoxy(1, 1);
+	lcd_buf_puts("temp. control");
 }
 
-// Menu display
-void showMenu() {
-	lcd_clrscr();
-	lcd_putc('<');
+#if INSTRUMENT
+// Right-aligned times of width digits in a common unit (us, ms or s)
+static void showTimes(const uint32_t *t, uint8_t n, uint8_t width) {
+	char buf[11];
+	uint32_t max = 0, div = 1, lim = 1;
+	uint8_t i, len;
 	
-	// Menu items
-	if (!subMenu){
-		lcd_gotoxy((16 - strlen(menu[mMode])) / 2, 0);
-		lcd_puts(menu[mMode]);
-		
-	// 'Variables' subMenu items
-	} else if (mMode == 0) {
-		lcd_gotoxy((16 - strlen(variables[mVar])) / 2, 0);
-		lcd_puts(variables[mVar]);
-		char buffer[4];
-		
-		if (!mSelect) {
-			lcd_gotoxy(6, 1);
-			if (mVar == 0 || mVar == 1 || mVar == 2) {
-				lcd_puts(itoa(var_mat[mVar], buffer, 10));
-				lcd_putc(223);
-				lcd_putc('C');
-			} else {
-				lcd_putc(' ');
-				lcd_puts(itoa(var_mat[mVar], buffer, 10));
-				lcd_putc(' ');
-			}
-		} else {
-			lcd_gotoxy(5, 1);
-			lcd_putc('<');
-			if (mVar == 0 || mVar == 1 || mVar == 2) {
-				lcd_puts(itoa(var_mat[mVar], buffer, 10));
-				lcd_putc(223);
-				lcd_putc('C');
-			} else {
-				lcd_putc(' ');
-				lcd_puts(itoa(var_mat[mVar], buffer, 10));
-				lcd_putc(' ');
-			}
-			lcd_putc('>');
-		}
-		
-	// 'Modes' subMenu items
-	} else if (mMode == 1) {
-		lcd_gotoxy(5, 0);
-		lcd_puts("Mode:");
-		lcd_gotoxy((14 - strlen(mode[mVar])) / 2, 1);
-		lcd_putc('<');
-		lcd_puts(mode[mVar]);
-		lcd_putc('>');
-		
-	// 'Alarms' subMenu items
-	} else {
-		lcd_gotoxy((16 - strlen(alarms[mVar])) / 2, 0);
-		lcd_puts(alarms[mVar]);
-		char buffer[4];
-		
-		if (!mSelect) {
-			lcd_gotoxy(6, 1);
-			if (mVar == 1 || mVar == 2) {
-				lcd_puts(itoa(alarms_mat[mVar], buffer, 10));
-				lcd_putc(223);
-				lcd_putc('C');
-			} else {
-				lcd_putc(' ');
-				lcd_puts(itoa(alarms_mat[mVar], buffer, 10));
-				lcd_putc(' ');
-			}
-		} else {
-			lcd_gotoxy(5, 1);
-			lcd_putc('<');
-			if (mVar == 1 || mVar == 2) {
-				lcd_puts(itoa(alarms_mat[mVar], buffer, 10));
-				lcd_putc(223);
-				lcd_putc('C');
-			} else {
-				lcd_putc(' ');
-				lcd_puts(itoa(alarms_mat[mVar], buffer, 10));
-				lcd_putc(' ');
-			}
-			lcd_putc('>');
-		}
+	for (i = 0; i < width; i++) lim *= 10;
+	for (i = 0; i < n; i++) if (t[i] > max) max = t[i];
+	while (max / div >= lim) div *= 1000;
+	
+	for (i = 0; i < n; i++) {
+		if (i) lcd_buf_putc(' ');
+		ultoa(t[i] / div, buf, 10);
+		for (len = strlen(buf); len < width; len++) lcd_buf_putc(' ');
+		lcd_buf_puts(buf);
+	}
+	lcd_buf_puts(div == 1 ? "us" : div == 1000 ? "ms" : " s");
+}
+
+// Byte count up to 9999, n/a in the host simulation
+static void showBytes(uint16_t n) {
+	if (n == STACK_UNKNOWN) {
+		lcd_buf_puts("n/a");
+		return;
+	}
+	fmt_u16(lcd_buf_field(4), n, 4);
+	lcd_buf_puts(" B");
+}
+
+// Diagnostics, even pages: count and min/avg/max duration,
+// odd pages: jitter (spread of the time between entries) and its min/max,
+// last page: RAM the stack has never reached and its deepest use
+void showDiag() {
+	instrStat_t st;
+	uint32_t t[3];
+	
+	if (diagPage == DIAG_PAGES - 1) {
+		lcd_buf_puts("RAM free  ");
+		showBytes(stack_free());
+		lcd_buf_gotoxy(0, 1);
+		lcd_buf_puts("stack max ");
+		showBytes(stack_used());
+		return;
 	}
 	
-	lcd_gotoxy(15, 0);
-	lcd_putc('>');
+	instr_get(diagPage >> 1, &st);
+	lcd_buf_puts_p(instr_names[diagPage >> 1]);
+	if (!(diagPage & 1)) {
+		lcd_buf_puts(" n ");
+		fmt_u16(lcd_buf_field(FMT_U16_WIDTH), st.count, FMT_U16_WIDTH);
+		if (!st.count) return;
+		t[0] = instr_us(st.min);
+		t[1] = instr_us(st.avg);
+		t[2] = instr_us(st.max);
+		lcd_buf_gotoxy(0, 1);
+		showTimes(t, 3, 4);
+	} else {
+		lcd_buf_puts(" jit ");
+		if (st.count < 2) return;
+		t[0] = instr_us(st.perMax - st.perMin);
+		showTimes(t, 1, 4);
+		t[0] = instr_us(st.perMin);
+		t[1] = instr_us(st.perMax);
+		lcd_buf_gotoxy(0, 1);
+		showTimes(t, 2, 5);
+	}
 }
+#endif
 
 /*
 ** Password functions
@@ -601,128 +621,158 @@ void resetPsw(char *tmpPsw){
 
 void setPsw() {
 	if (!pswSet) {
-		lcd_clrscr();
-		lcd_gotoxy(1, 0);
-		lcd_puts("Set password:");
-		lcd_gotoxy(4, 1);
+		lcd_buf_gotoxy(1, 0);
+		lcd_buf_puts("Set password:");
+		lcd_buf_gotoxy(4, 1);
 		
 		for (uint8_t i = 0; i < 4; i++){
 			if (mVar == i) {
-				lcd_putc(mSelect ? '<' : ' ');
-				lcd_putc(password[i]);
-				lcd_putc(mSelect ? '>' : ' ');
-			} else lcd_putc(password[i]);
+				lcd_buf_putc(mSelect ? '<' : ' ');
+				lcd_buf_putc(config.password[i]);
+				lcd_buf_putc(mSelect ? '>' : ' ');
+			} else lcd_buf_putc(config.password[i]);
 		}
 	} else if (pswUse) {
-		lcd_clrscr();
-		lcd_gotoxy(2, 0);
-		lcd_puts("Password set");
-		lcd_gotoxy(4, 1);
-		lcd_puts("->");
+		lcd_buf_gotoxy(2, 0);
+		lcd_buf_puts("Password set");
+		lcd_buf_gotoxy(4, 1);
+		lcd_buf_puts("->");
 		for (uint8_t i = 0; i < 4; i++){
-			lcd_putc(password[i]);
+			lcd_buf_putc(config.password[i]);
 		}
-		lcd_puts("<-");
+		lcd_buf_puts("<-");
 	} else {
-		lcd_clrscr();
-		lcd_gotoxy(2, 0);
-		lcd_puts("Password not");
-		lcd_gotoxy(6, 1);
-		lcd_puts("used");
+		lcd_buf_gotoxy(2, 0);
+		lcd_buf_puts("Password not");
+		lcd_buf_gotoxy(6, 1);
+		lcd_buf_puts("used");
 	}
 }
 
 void enterPsw() {
 	if (!pswError) {
-		lcd_clrscr();
-		lcd_puts("Enter password:");
-		lcd_gotoxy(4, 1);
+		lcd_buf_puts("Enter password:");
+		lcd_buf_gotoxy(4, 1);
 		
 		for (uint8_t i = 0; i < 4; i++){
 			if (mVar == i) {
-				lcd_putc(mSelect ? '<' : ' ');
-				lcd_putc(tmpPassword[i]);
-				lcd_putc(mSelect ? '>' : ' ');
-			} else lcd_putc(tmpPassword[i]);
+				lcd_buf_putc(mSelect ? '<' : ' ');
+				lcd_buf_putc(tmpPassword[i]);
+				lcd_buf_putc(mSelect ? '>' : ' ');
+			} else lcd_buf_putc(tmpPassword[i]);
 		}
 	} else {
-		lcd_clrscr();
-		lcd_gotoxy(3, 0);
-		lcd_puts("Incorrect");
-		lcd_gotoxy(4, 1);
-		lcd_puts("password");
+		lcd_buf_gotoxy(3, 0);
+		lcd_buf_puts("Incorrect");
+		lcd_buf_gotoxy(4, 1);
+		lcd_buf_puts("password");
 	}
 }
 
 uint8_t checkPsw(const char *toCheck) {
 	for (uint8_t i = 0; i < 4; i++) {
-		if (toCheck[i] != password[i]) return 0;
+		if (toCheck[i] != config.password[i]) return 0;
 	}
 	return 1;
 }
 
 /*
-** ADC and moving average functions
+** Control functions
 */
 
-// Calculate moving average
-uint16_t getMovAvg(uint16_t newSample, movAvg_t *ma)
-{
-	// Remove oldest sample from the sum
-	ma->sum -= ma->samples[ma->samIdx];
-	// Add the new sample to the sum and to samples array
-	ma->sum += newSample;
-	ma->samples[ma->samIdx] = newSample;
-	// Increment index and roll down to 0 if necessary
-	ma->samIdx++;
-	if( ma->samIdx == TOT_SAMPLES ){
-		ma->samIdx = 0;
+// PID control of the heater (time-proportioned PORTA1) and
+// the fan (PWM duty on OC1B, enable on PORTA2)
+void control() {
+	int16_t temp = tempTenths;
+	int16_t out;
+	
+	if (config.modeSelect == 3) {
+		// autotune: relay experiment around set temp, then back to the previous mode
+		if (lastMode != 3) {
+			tuneReturn = lastMode;
+			lastMode = 3;
+			autotune_start(&tune, TENTHS(config.var_mat[2]));
+		}
+		out = autotune_update(&tune, temp);
+		if (tune.state != AT_RUN) {
+			// new gains go to EEPROM with the mode change
+			if (autotune_gains(&tune, &pid)) {
+				config.kp = pid.kp;
+				config.ki = pid.ki;
+				config.kd = pid.kd;
+			}
+			config.modeSelect = tuneReturn;
+			redraw = 1;
+		}
+	} else {
+		if (config.modeSelect != lastMode) pidMode(config.modeSelect);
+		pid.deadband = TENTHS(config.var_mat[3]);
+		out = pid_update(&pid, TENTHS(config.var_mat[2]), temp);
 	}
+	
+	tprop_set(TPROP_CH_HEATER, out > 0 ? (uint16_t)out * 100 / PID_OUT_MAX : 0);
+	
+	if (out < 0) {
+		hal_fan_pwm(-out);
+		hal_out_set(HAL_OUT_FAN);
+	} else {
+		hal_fan_pwm(0);
+		hal_out_clear(HAL_OUT_FAN);
+	}
+	
+	lock = out != 0;
+	ctrlOut = out;
+	
+	hist_add(temp, (out > 0 ? HIST_F_HEATER : 0) | (out < 0 ? HIST_F_FAN : 0) | (alarmOn ? HIST_F_ALARM : 0));
+}
 
-	// return moving average - divide the sum by 2^MOVAVG_SHIFT
-	return ma->sum >> MOVAVG_SHIFT;
+// PID output range of a working mode: heat >= 0, cool <= 0, balance both
+void pidMode(uint8_t mode) {
+	lastMode = mode;
+	pid_reset(&pid);
+	pid_limits(&pid, mode == 0 ? 0 : -PID_OUT_MAX, mode == 1 ? 0 : PID_OUT_MAX);
 }
 
-// Read ADC value
-uint16_t readAdc(uint8_t channel)
-{
-	//choose channel
-	ADMUX &= ~(0x7);
-	ADMUX |= channel;
+// Status frame, every value goes straight into the UART ring
+void sendStatus() {
+	int16_t temp = tempTenths;
+	uint8_t flags = 0;
+	uint8_t lcdHwm = 0;
+	uint16_t lcdDropped = 0;
 	
-	//start conversion
-	ADCSRA |= _BV(ADSC);
-
-	//wait until conversion completes
-	while (ADCSRA & _BV(ADSC) );
+#if LCD_ASYNC
+	lcd_queue_stats(&lcdHwm, &lcdDropped);
+#endif
+	if (tprop_on(TPROP_CH_HEATER)) flags |= TELEM_F_HEATER;
+	if (ctrlOut < 0) flags |= TELEM_F_FAN;
+	if (alarmOn) flags |= TELEM_F_ALARM;
+	if (config.alarms_mat[3]) flags |= TELEM_F_ALARM_USE;
+	if (config.alarms_mat[4] && lock) flags |= TELEM_F_LOCK;
+	if (eeconf_busy()) flags |= TELEM_F_SAVING;
 	
-	return ADCW;
+	if (!telem_begin(TELEM_STATUS, TELEM_STATUS_LEN)) return;
+	telem_put16(temp);
+	telem_put16(adc_raw(ADC_CH_TEMP));
+	telem_put16(TENTHS(config.var_mat[2]));
+	telem_put16(ctrlOut);
+	telem_put8(ctrlOut < 0 ? -ctrlOut : 0);
+	telem_put8(config.modeSelect);
+	telem_put8(flags);
+	telem_put16(stack_free());
+	telem_put16(idle_wakeups());
+	telem_put8(idle_asleep());
+	telem_put8(lcdHwm);
+	telem_put16(lcdDropped);
+	telem_put16(adc_overruns());
+	telem_put16(uart_rx_overruns());
+	telem_put16(telem_dropped());
+	telem_end();
 }
 
 /*
 ** Initialization and general functions
 */
 
-// Initialize moving average structure
-void init_temp_ma(movAvg_t *ma, int8_t totSamples)
-{
-	int i;
-	
-	ma->samIdx = 0;
-	ma->sum = 0;
-	for(i=0; i<totSamples; i++){
-		ma->samples[i] = 0;
-	}
-}
-
-void init_adc()
-{
-	//adc enable, prescaler=64 -> clk=115200
-	ADCSRA = _BV(ADEN)|_BV(ADPS2)|_BV(ADPS1);
-	//2.56V reference voltage
-	ADMUX = _BV(REFS0) | _BV(REFS1);
-}
-
 void init_spec_char(){
 	lcd_command(0x40);	// set CGRAM address for first character
 	
@@ -751,19 +801,11 @@ void init_spec_char(){
 	lcd_putc(1);
 }
 
-void nonBlockingDebounce() {
-	GICR &= ~_BV(INT0);
-	sei();
-
-	_delay_ms(500);
-	GIFR = _BV(INTF0);
-	GICR |= _BV(INT0);
-
-	cli();
-}
 
-void writeOnLCD() {
-	lcd_clrscr();
+// Render the current screen into the shadow framebuffer and send the changed cells,
+// returns 1 while cells are still waiting for LCD queue space
+uint8_t writeOnLCD() {
+	lcd_buf_clear();
 	
 	switch (dMode){
 		case 0:
@@ -773,7 +815,7 @@ void writeOnLCD() {
 		showTemperature();
 		break;
 		case 2:
-		showMenu();
+		menu_render();
 		break;
 		case 3:
 		setPsw();
@@ -781,7 +823,24 @@ void writeOnLCD() {
 		case 4:
 		enterPsw();
 		break;
+#if INSTRUMENT
+		case 5:
+		showDiag();
+		break;
+#endif
 	}
+	
+	return lcd_flush();
 }
 
+#ifdef BENCH
+/*
+** Benchmark hooks, bench/bench.c
+*/
 
+// Select the screen the next writeOnLCD() renders
+void bench_screen(uint8_t d)
+{
+	dMode = d;
+}
+#endif
@@ -0,0 +1,210 @@
+/*
+ * menu.c
+ *
+ * Table-driven configuration menu
+ */ 
+#include <avr/pgmspace.h>
+
+#include "hal.h"
+#include "config.h"
+#include "lcd.h"
+#include "menu.h"
+#include "fmt.h"
+
+/*
+** Descriptor tables
+*/
+
+static const char nHeat[] PROGMEM = "heat";
+static const char nCool[] PROGMEM = "cool";
+static const char nBal[] PROGMEM = "bal ";
+static const char nTune[] PROGMEM = "tune";
+static const char *const modeNames[CFG_NUM_MODES] PROGMEM = { nHeat, nCool, nBal, nTune };
+
+static const menuItem_t varItems[] PROGMEM = {
+	{ "max temp",		CFG_VARS,	CFG_MAX_TEMP,	1, MENU_UNIT_C | MENU_WRAP, NULL },
+	{ "min temp",		CFG_VARS,	CFG_MIN_TEMP,	1, MENU_UNIT_C | MENU_WRAP, NULL },
+	{ "set temp",		CFG_VARS,	CFG_SET_TEMP,	1, MENU_UNIT_C | MENU_WRAP, NULL },
+	{ "temp diff",		CFG_VARS,	CFG_TEMP_DIFF,	1, MENU_WRAP, NULL },
+};
+
+static const menuItem_t modeItems[] PROGMEM = {
+	{ "Mode:",			CFG_MODE,	0,				1, MENU_HOLD_LAST, modeNames },
+};
+
+static const menuItem_t alarmItems[] PROGMEM = {
+	{ "alarm diff",		CFG_ALARMS,	CFG_ALARM_DIFF,	1, MENU_WRAP, NULL },
+	{ "alarm high",		CFG_ALARMS,	CFG_ALARM_HIGH,	1, MENU_UNIT_C | MENU_WRAP, NULL },
+	{ "alarm low",		CFG_ALARMS,	CFG_ALARM_LOW,	1, MENU_UNIT_C | MENU_WRAP, NULL },
+	{ "alarm usage",	CFG_ALARMS,	CFG_ALARM_USE,	1, MENU_WRAP, NULL },
+	{ "lock usage",		CFG_ALARMS,	CFG_LOCK_USE,	1, MENU_WRAP, NULL },
+};
+
+#define ITEMS(t) t, sizeof(t) / sizeof(t[0])
+
+static const menuPage_t pages[] PROGMEM = {
+	{ "Variables",	ITEMS(varItems),	0 },
+	{ "Modes",		ITEMS(modeItems),	MENU_DIRECT },
+	{ "Alarm",		ITEMS(alarmItems),	0 },
+};
+
+#define MENU_PAGES (sizeof(pages) / sizeof(pages[0]))
+
+/*
+** State
+*/
+
+static uint8_t page = 0;		// menu mode
+static uint8_t item = 0;		// item of the open page
+static uint8_t inPage = 0;		// page open
+static uint8_t selected = 0;	// item being edited
+static uint8_t armed = 0;		// key pressed on an open MENU_DIRECT page, HAL_KEY* mask
+
+static const menuItem_t *cur_item()
+{
+	return (const menuItem_t *)pgm_read_ptr(&pages[page].items) + item;
+}
+
+// Value of the current item up (dir 1) or down (dir -1)
+static void step_item(int8_t dir, uint8_t step)
+{
+	const menuItem_t *it = cur_item();
+	uint8_t group = pgm_read_byte(&it->group);
+	uint8_t idx = pgm_read_byte(&it->idx);
+	uint8_t flags = pgm_read_byte(&it->flags);
+	
+	if (flags & MENU_HOLD_LAST) {
+		// one at a time around lo..hi - 1, from the last value to either end
+		uint8_t lo = config_min(group, idx);
+		uint8_t hi = config_max(group, idx) - 1;
+		uint8_t v = config_get(group, idx);
+		
+		config_set(group, idx, dir > 0 ? (v >= hi ? lo : v + 1) : (v <= lo || v > hi ? hi : v - 1));
+		return;
+	}
+	config_step(group, idx, dir * pgm_read_byte(&it->step) * step, flags & MENU_WRAP);
+}
+
+// Flash string centered on line y
+static void center_p(const char *s, uint8_t width, uint8_t y)
+{
+	lcd_buf_gotoxy((width - strlen_P(s)) / 2, y);
+	lcd_buf_puts_p(s);
+}
+
+/*
+** Functions
+*/
+
+// Back to the first page, nothing open
+void menu_reset()
+{
+	page = 0;
+	item = 0;
+	inPage = 0;
+	selected = 0;
+	armed = 0;
+}
+
+// A value is selected, held keys repeat
+uint8_t menu_editing()
+{
+	return selected;
+}
+
+// Key1..3 press or repeat, keys is a HAL_KEY* mask, step multiplies the
+// item step
+void menu_key(uint8_t keys, uint8_t step)
+{
+	uint8_t direct = pgm_read_byte(&pages[page].flags) & MENU_DIRECT;
+	
+	if (keys & HAL_KEY1) {
+		if (!inPage) page = (page + 1) % MENU_PAGES;
+		else if (selected) step_item(1, step);
+		else if (direct) armed = HAL_KEY1;
+		else item = (item + 1) % pgm_read_byte(&pages[page].count);
+	} else if (keys & HAL_KEY2) {
+		if (!inPage) inPage = 1;
+		else if (selected) step_item(-1, step);
+		else if (direct) armed = HAL_KEY2;
+		else selected = 1;
+	} else if (keys & HAL_KEY3) {
+		if (selected) {
+			selected = 0;
+		} else {
+			inPage = 0;
+			item = 0;
+		}
+	}
+}
+
+// Key1/key2 released before the long-press, steps the item of an open
+// MENU_DIRECT page when the key was pressed there
+void menu_short(uint8_t keys)
+{
+	if (!(armed & keys)) return;
+	armed = 0;
+	step_item(keys & HAL_KEY1 ? 1 : -1, 1);
+}
+
+// Key1/key2 held ~1 s, key1 on an open MENU_DIRECT page sets the
+// MENU_HOLD_LAST value
+void menu_long(uint8_t keys)
+{
+	const menuItem_t *it = cur_item();
+	
+	if (!(armed & keys)) return;
+	armed = 0;
+	if ((keys & HAL_KEY1) && (pgm_read_byte(&it->flags) & MENU_HOLD_LAST))
+		config_set(pgm_read_byte(&it->group), pgm_read_byte(&it->idx),
+			config_max(pgm_read_byte(&it->group), pgm_read_byte(&it->idx)));
+}
+
+// Page name, or item name and value
+void menu_render()
+{
+	const menuItem_t *it;
+	const char *const *names;
+	uint8_t v, flags;
+	
+	lcd_buf_putc('<');
+	
+	if (!inPage) {
+		center_p(pages[page].name, 16, 0);
+	} else {
+		it = cur_item();
+		center_p(it->name, 16, 0);
+		v = config_get(pgm_read_byte(&it->group), pgm_read_byte(&it->idx));
+		flags = pgm_read_byte(&it->flags);
+		names = pgm_read_ptr(&it->names);
+		
+		if (names) {
+			// named values are always shown as <name>
+			const char *s = pgm_read_ptr(&names[v]);
+			
+			lcd_buf_gotoxy((14 - strlen_P(s)) / 2, 1);
+			lcd_buf_putc('<');
+			lcd_buf_puts_p(s);
+			lcd_buf_putc('>');
+		} else {
+			lcd_buf_gotoxy(selected ? 5 : 6, 1);
+			if (selected) lcd_buf_putc('<');
+			if (!(flags & MENU_UNIT_C)) lcd_buf_putc(' ');
+			fmt_u8(lcd_buf_field(2), v, 2);
+			if (flags & MENU_UNIT_C) {
+				lcd_buf_putc(223);
+				lcd_buf_putc('C');
+			} else lcd_buf_putc(' ');
+			if (selected) lcd_buf_putc('>');
+		}
+	}
+	
+	lcd_buf_gotoxy(15, 0);
+	lcd_buf_putc('>');
+}
+
+// Working mode name in flash, for the temperature display
+const char *menu_mode_name(uint8_t mode)
+{
+	return pgm_read_ptr(&modeNames[mode]);
+}
@@ -0,0 +1,58 @@
+/*
+ * menu.h
+ *
+ * Configuration menu (dMode 2) run from descriptor tables in flash. The top
+ * level steps through the pages, a page through its items and a selected
+ * item edits one config value. Names, step, unit, wrap behaviour and the
+ * value names of every item are in PROGMEM, the value ranges come from the
+ * config.c table. Adding a parameter is one line in the page's item table.
+ *
+ *   key1  next page / next item / value up
+ *   key2  open page / select item / value down
+ *   key3  deselect item / back to the pages, held ~1 s leaves the menu
+ *
+ * A page with MENU_DIRECT has one item that key1/key2 change without
+ * selecting it (the working mode), on release so that holding key1 can do
+ * something else: with MENU_HOLD_LAST the steps go around all values but
+ * the last one and key1 held ~1 s sets that (autotune).
+ */ 
+#ifndef MENU_H
+#define MENU_H
+
+#include <inttypes.h>
+
+#define MENU_NAME_LEN	12		// with the terminating 0
+
+// Item flags
+#define MENU_UNIT_C		0x01	// value in degrees, printed with 'oC'
+#define MENU_WRAP		0x02	// steps go around at the range ends, else stop there
+#define MENU_HOLD_LAST	0x04	// last value left out of the steps, set by holding key1
+
+// Page flags
+#define MENU_DIRECT		0x01	// single item, changed without selecting it
+
+typedef struct{
+	char name[MENU_NAME_LEN];
+	uint8_t group;					// CFG_VARS, CFG_ALARMS or CFG_MODE
+	uint8_t idx;
+	uint8_t step;					// change per key press, times the repeat step
+	uint8_t flags;
+	const char *const *names;		// PROGMEM names of the values, NULL for numbers
+}menuItem_t;
+
+typedef struct{
+	char name[MENU_NAME_LEN];
+	const menuItem_t *items;
+	uint8_t count;
+	uint8_t flags;
+}menuPage_t;
+
+void menu_reset();
+uint8_t menu_editing();
+void menu_key(uint8_t keys, uint8_t step);
+void menu_short(uint8_t keys);
+void menu_long(uint8_t keys);
+void menu_render();
+const char *menu_mode_name(uint8_t mode);
+
+#endif //MENU_H
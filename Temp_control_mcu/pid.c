@@ -0,0 +1,68 @@
+/*
+ * pid.c
+ *
+ * Fixed-point PID controller with anti-windup and derivative on measurement
+ */ 
+#include "pid.h"
+
+// Default gains, full output range
+void pid_init(pidCtrl_t *pid)
+{
+	pid->kp = PID_KP_DEFAULT;
+	pid->ki = PID_KI_DEFAULT;
+	pid->kd = PID_KD_DEFAULT;
+	pid->deadband = 0;
+	pid->outMin = -PID_OUT_MAX;
+	pid->outMax = PID_OUT_MAX;
+	pid_reset(pid);
+}
+
+// Clear the controller history, e.g. after a mode change
+void pid_reset(pidCtrl_t *pid)
+{
+	pid->integ = 0;
+	pid->primed = 0;
+}
+
+// Output range, the integrator is pulled back inside it
+void pid_limits(pidCtrl_t *pid, int16_t outMin, int16_t outMax)
+{
+	pid->outMin = outMin;
+	pid->outMax = outMax;
+	if (pid->integ > (int32_t)outMax << 8) pid->integ = (int32_t)outMax << 8;
+	if (pid->integ < (int32_t)outMin << 8) pid->integ = (int32_t)outMin << 8;
+}
+
+// One control period, returns the clamped output
+int16_t pid_update(pidCtrl_t *pid, int16_t setpoint, int16_t meas)
+{
+	int16_t err = setpoint - meas;
+	int32_t out, integ;
+	
+	if (err <= pid->deadband && err >= -pid->deadband) err = 0;
+	
+	// derivative on measurement, no kick on setpoint changes
+	if (!pid->primed) {
+		pid->lastMeas = meas;
+		pid->primed = 1;
+	}
+	out = (int32_t)pid->kp * err - (int32_t)pid->kd * (meas - pid->lastMeas);
+	pid->lastMeas = meas;
+	
+	// anti-windup: integrate only while it does not push a saturated
+	// output further, and keep the integral itself within the limits
+	integ = pid->integ + (int32_t)pid->ki * err;
+	if (integ > (int32_t)pid->outMax << 8) integ = (int32_t)pid->outMax << 8;
+	if (integ < (int32_t)pid->outMin << 8) integ = (int32_t)pid->outMin << 8;
+	
+	out += integ;
+	if (out > (int32_t)pid->outMax << 8) {
+		out = (int32_t)pid->outMax << 8;
+		if (err < 0) pid->integ = integ;
+	} else if (out < (int32_t)pid->outMin << 8) {
+		out = (int32_t)pid->outMin << 8;
+		if (err > 0) pid->integ = integ;
+	} else pid->integ = integ;
+	
+	return out >> 8;
+}
@@ -0,0 +1,36 @@
+/*
+ * pid.h
+ *
+ * Fixed-point PID controller. Gains are Q8.8 and scaled per control period,
+ * measurement and setpoint in 0.1 C, output in duty units (255 = full).
+ */ 
+#ifndef PID_H
+#define PID_H
+
+#include <inttypes.h>
+
+// Default gains, Q8.8
+#define PID_KP_DEFAULT	(8 * 256)	// 8 duty per 0.1 C of error
+#define PID_KI_DEFAULT	(64)		// 0.25 duty per 0.1 C per period
+#define PID_KD_DEFAULT	(4 * 256)	// 4 duty per 0.1 C change per period
+
+#define PID_OUT_MAX 255
+
+typedef struct{
+	int16_t kp;
+	int16_t ki;
+	int16_t kd;
+	int16_t deadband;	// errors within +-deadband count as zero
+	int16_t outMin;
+	int16_t outMax;
+	int32_t integ;		// integral term, Q8.8 duty
+	int16_t lastMeas;
+	uint8_t primed;		// lastMeas valid
+}pidCtrl_t;
+
+void pid_init(pidCtrl_t *pid);
+void pid_reset(pidCtrl_t *pid);
+void pid_limits(pidCtrl_t *pid, int16_t outMin, int16_t outMax);
+int16_t pid_update(pidCtrl_t *pid, int16_t setpoint, int16_t meas);
+
+#endif //PID_H
@@ -0,0 +1,45 @@
+/*
+ * sched.c
+ *
+ * Pending event set shared by the interrupts and the main loop
+ */ 
+#include <util/atomic.h>
+
+#include "sched.h"
+
+#if SCHED_NUM > 8
+#error "SCHED_NUM events must fit the 8 bit pending set"
+#endif
+
+// Bit per event, set by sched_post() and cleared by sched_next()
+static volatile uint8_t pending = 0;
+
+// Mark ev pending, from an ISR or the main loop
+void sched_post(uint8_t ev)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		pending |= 1 << ev;
+	}
+}
+
+// Take the highest priority pending event, SCHED_NONE when there is none
+uint8_t sched_next()
+{
+	uint8_t ev, bit;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (ev = 0, bit = 1; ev < SCHED_NUM; ev++, bit <<= 1) {
+			if (pending & bit) {
+				pending &= ~bit;
+				return ev;
+			}
+		}
+	}
+	return SCHED_NONE;
+}
+
+// Events wait for the main loop
+uint8_t sched_pending()
+{
+	return pending != 0;
+}
@@ -0,0 +1,32 @@
+/*
+ * sched.h
+ *
+ * Run-to-completion event scheduler for the main loop. Interrupt handlers
+ * only post events, the main loop takes them highest priority first and
+ * runs their handler to completion before it looks at the next one, so
+ * the screens, menu, alarm and control state are only touched from the
+ * main context. An event is one bit of the pending set: posting it again
+ * before it ran merges with the pending one. Events with data (key events,
+ * ADC samples) keep it in the producing module's queue and the handler
+ * drains that queue.
+ */ 
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <inttypes.h>
+
+// Events, lower number runs first
+#define SCHED_SAMPLE	0		// ADC samples waiting to be filtered
+#define SCHED_CONTROL	1		// PID period, every CONTROL_TICKS
+#define SCHED_ALARM		2		// temperature or limits changed, check the alarm
+#define SCHED_KEY		3		// key events queued by keys_tick()
+#define SCHED_TELEM		4		// status frame due, every TELEM_TICKS
+#define SCHED_REFRESH	5		// display refresh period, every REFRESH_TICKS
+#define SCHED_NUM		6		// at most 8
+#define SCHED_NONE		0xFF
+
+void sched_post(uint8_t ev);
+uint8_t sched_next();
+uint8_t sched_pending();
+
+#endif //SCHED_H
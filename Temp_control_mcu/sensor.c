@@ -0,0 +1,75 @@
+/*
+ * sensor.c
+ *
+ * ADC code to temperature conversion with two-point calibration
+ */ 
+#include <avr/pgmspace.h>
+
+#include "sensor.h"
+
+// Temperature in 0.1 C at code (i << SENSOR_LUT_SHIFT), rounded, evaluated at compile time
+#define LUT_UV(i)	((((long long)(i) << SENSOR_LUT_SHIFT) * SENSOR_VREF_MV * 1000) >> ADC_RESULT_BITS)
+#define LUT_ENTRY(i)	((int16_t)(((LUT_UV(i) - SENSOR_OFFSET_UV) * 10 + SENSOR_SLOPE_UV / 2) / SENSOR_SLOPE_UV))
+#define LUT_4(i)	LUT_ENTRY(i), LUT_ENTRY((i) + 1), LUT_ENTRY((i) + 2), LUT_ENTRY((i) + 3)
+#define LUT_16(i)	LUT_4(i), LUT_4((i) + 4), LUT_4((i) + 8), LUT_4((i) + 12)
+#define LUT_64(i)	LUT_16(i), LUT_16((i) + 16), LUT_16((i) + 32), LUT_16((i) + 48)
+
+static const int16_t lut[SENSOR_LUT_SEGMENTS + 1] PROGMEM = {
+	LUT_64(0), LUT_ENTRY(SENSOR_LUT_SEGMENTS)
+};
+
+// Calibration, main loop only (SCHED_SAMPLE handler, UART commands)
+static uint16_t calGain = SENSOR_GAIN_ONE;
+static int16_t calOffset = 0;
+
+// Uncalibrated temperature in 0.1 C, table lookup with linear interpolation
+int16_t sensor_raw_tenths(uint16_t code)
+{
+	uint8_t idx = code >> SENSOR_LUT_SHIFT;
+	uint8_t frac = code & ((1 << SENSOR_LUT_SHIFT) - 1);
+	int16_t lo, hi;
+	
+	if (idx >= SENSOR_LUT_SEGMENTS) return pgm_read_word(&lut[SENSOR_LUT_SEGMENTS]);
+	lo = pgm_read_word(&lut[idx]);
+	hi = pgm_read_word(&lut[idx + 1]);
+	return lo + (((int32_t)(hi - lo) * frac) >> SENSOR_LUT_SHIFT);
+}
+
+// Calibrated temperature in 0.1 C, for the SCHED_SAMPLE handler
+int16_t sensor_to_tenths(uint16_t code)
+{
+	int32_t t = sensor_raw_tenths(code);
+	
+	return ((t * calGain) >> SENSOR_GAIN_SHIFT) + calOffset;
+}
+
+// Two-point calibration from uncalibrated readings meas1/meas2 taken at
+// reference temperatures ref1/ref2 (all in 0.1 C), returns 0 and keeps
+// the previous calibration when the points are too close or the gain is
+// off by more than 50%
+uint8_t sensor_calibrate(int16_t meas1, int16_t ref1, int16_t meas2, int16_t ref2)
+{
+	int32_t gain, offset;
+	
+	if (meas2 - meas1 < 50 && meas1 - meas2 < 50) return 0;
+	
+	gain = ((int32_t)(ref2 - ref1) << SENSOR_GAIN_SHIFT) / (meas2 - meas1);
+	if (gain < SENSOR_GAIN_ONE / 2 || gain > SENSOR_GAIN_ONE * 3 / 2) return 0;
+	offset = ref1 - (((int32_t)meas1 * gain) >> SENSOR_GAIN_SHIFT);
+	
+	sensor_set_cal(gain, offset);
+	return 1;
+}
+
+// Set gain (Q2.14) and offset (0.1 C), e.g. from stored configuration
+void sensor_set_cal(uint16_t gain, int16_t offset)
+{
+	calGain = gain;
+	calOffset = offset;
+}
+
+void sensor_get_cal(uint16_t *gain, int16_t *offset)
+{
+	*gain = calGain;
+	*offset = calOffset;
+}
@@ -0,0 +1,36 @@
+/*
+ * sensor.h
+ *
+ * ADC code to temperature conversion. A table of temperatures at every
+ * 2^SENSOR_LUT_SHIFT codes is generated by the preprocessor from the sensor
+ * model below and kept in flash, codes in between are interpolated. A field
+ * two-point calibration is applied to the result as one fixed-point
+ * multiply-add.
+ */ 
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <inttypes.h>
+
+#include "adc.h"
+
+// Sensor model: Vout = SENSOR_OFFSET_UV + SENSOR_SLOPE_UV * T[C]
+#define SENSOR_VREF_MV		2560	// ADC reference
+#define SENSOR_SLOPE_UV		10000	// TMP35: 10 mV/C
+#define SENSOR_OFFSET_UV	0		// TMP35: 0 V at 0 C (TMP36: 500000)
+
+// 64 table segments over the ADC_RESULT_BITS code range
+#define SENSOR_LUT_SEGMENTS	64
+#define SENSOR_LUT_SHIFT	(ADC_RESULT_BITS - 6)
+
+// Calibration gain is Q2.14, 1.0 = SENSOR_GAIN_ONE
+#define SENSOR_GAIN_SHIFT	14
+#define SENSOR_GAIN_ONE		(1 << SENSOR_GAIN_SHIFT)
+
+int16_t sensor_raw_tenths(uint16_t code);
+int16_t sensor_to_tenths(uint16_t code);
+uint8_t sensor_calibrate(int16_t meas1, int16_t ref1, int16_t meas2, int16_t ref2);
+void sensor_set_cal(uint16_t gain, int16_t offset);
+void sensor_get_cal(uint16_t *gain, int16_t *offset);
+
+#endif //SENSOR_H
@@ -0,0 +1,15 @@
+/*
+ * avr/interrupt.h
+ *
+ * Host shim: handlers become plain functions the simulator calls by vector
+ */ 
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include "../sim.h"
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#endif //SIM_AVR_INTERRUPT_H
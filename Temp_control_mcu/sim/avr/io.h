@@ -0,0 +1,21 @@
+/*
+ * avr/io.h
+ *
+ * Host shim: bit helpers only, there are no registers so application code
+ * has to go through hal.h
+ */ 
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <inttypes.h>
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+// ADCSRA prescaler bits, hal_adc_init() takes them as on the target
+#define ADPS0	0
+#define ADPS1	1
+#define ADPS2	2
+
+#endif //SIM_AVR_IO_H
@@ -0,0 +1,25 @@
+/*
+ * avr/pgmspace.h
+ *
+ * Host shim: flash and RAM share one address space
+ */ 
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <inttypes.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char *
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strcmp_P strcmp
+#define strcat_P strcat
+#define memcpy_P memcpy
+
+#endif //SIM_AVR_PGMSPACE_H
@@ -0,0 +1,27 @@
+/*
+ * avr/sleep.h
+ *
+ * Host shim: sleep_cpu() advances to the next interrupt, in ADC Noise
+ * Reduction mode it starts a conversion and stops the timers meanwhile
+ */ 
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include "../sim.h"
+
+#define SLEEP_MODE_IDLE		0
+#define SLEEP_MODE_ADC		1
+#define SLEEP_MODE_PWR_DOWN	2
+#define SLEEP_MODE_PWR_SAVE	3
+#define SLEEP_MODE_STANDBY	6
+
+extern uint8_t sim_sleep_mode;
+extern uint8_t sim_sleep_enabled;
+
+#define set_sleep_mode(mode) (sim_sleep_mode = (mode))
+#define sleep_enable() (sim_sleep_enabled = 1)
+#define sleep_disable() (sim_sleep_enabled = 0)
+#define sleep_cpu() sim_sleep()
+#define sleep_mode() do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif //SIM_AVR_SLEEP_H
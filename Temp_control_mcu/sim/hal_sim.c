@@ -0,0 +1,532 @@
+/*
+ * hal_sim.c
+ *
+ * Simulated backend of hal.h: output pins, scripted keys, Timer0 and Timer2
+ * compare ticks, the ADC with scripted inputs, the USART with scripted
+ * received text, the EEPROM with an optional image file and an optional first-order thermal plant driven by the heater and fan outputs
+ */ 
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "avr/sleep.h"
+#include "../hal.h"
+
+// Cycles charged per main loop pass, hal_idle()
+#define SIM_LOOP_CYCLES	2000
+
+#define NEVER UINT64_MAX
+
+static uint8_t outputs;
+static uint8_t fanDuty;
+static uint64_t keyUntil[4];		// key1..3, mode: held until then
+
+// Timer0 tick and Timer2 LCD tick, compare flags are raised on period boundaries,
+// Timer1 overflows every 256 * 8 cycles in the fan PWM mode
+static uint64_t t0Next = NEVER;
+static uint64_t t0Period = 1024UL * (HAL_TICK_OCR + 1);
+static uint64_t t1Next = NEVER;
+static uint64_t t2Base, t2Period, t2Off, t2Next = NEVER;
+
+// ADC
+static uint8_t adcOn, adcFreeRun, adcMux, adcCh;
+static uint32_t adcConv;			// cycles per conversion
+static uint64_t adcDone = NEVER;
+static uint16_t adcResult;
+static uint16_t adcInput[8];
+static uint8_t noiseLsb;
+static uint32_t lcg = 1;
+
+// USART transmitter: UDR buffer plus shift register, 10 bits per byte at the
+// baud rate. UDRE is a level, the pending flag of its vector follows it.
+// ADC Noise Reduction sleep stops clkI/O, a byte that is being shifted out
+// then stalls on the line and the receiver gets garbage: it never reaches
+// the sink.
+static uint32_t uartFrame;			// cycles per byte
+static uint64_t uartDone = NEVER;	// shift register empty again
+static uint8_t uartShift, uartStalled;
+static uint8_t uartBuf, uartBufFull;
+static int uartFd = -1;
+static uint32_t uartBytes, uartCorrupt;
+
+// USART receiver, scripted text arrives one byte per frame time on the
+// sender's clock. Bytes that are on the line while clkI/O is stopped are lost.
+static char rxText[256];
+static uint16_t rxLen, rxPos;
+static uint64_t rxNext = NEVER;
+static uint8_t rxData, rxStalled;
+static uint32_t rxLost;
+
+// EEPROM, erased out of reset. Writes take 8.5 ms on their own oscillator,
+// so they go on in sleep. EE_RDY is a level like UDRE.
+#define SIM_EE_WRITE_US	8500
+static uint8_t eeMem[HAL_EEPROM_SIZE];
+static uint64_t eeDone = NEVER;
+static const char *eeFile;
+static uint32_t eeWrites;
+
+// Thermal plant in 0.1 C, replaces the channel 0 input when set up
+static uint8_t plantOn;
+static double plantT, plantAmb, plantHeat, plantFan, plantTau;
+static uint64_t plantLast;
+
+static void plant_update()
+{
+	double dt, target;
+	
+	if (!plantOn) return;
+	dt = (double)(sim_now - plantLast) / F_CPU;
+	plantLast = sim_now;
+	target = plantAmb;
+	if (outputs & HAL_OUT_HEATER) target += plantHeat;
+	if (outputs & HAL_OUT_FAN) target -= plantFan * fanDuty / 255.0;
+	plantT += (target - plantT) * (dt < plantTau ? dt / plantTau : 1.0);
+}
+
+static uint16_t adc_sample(uint8_t ch)
+{
+	int32_t v = adcInput[ch & 7];
+	
+	if (ch == 0 && plantOn) {
+		plant_update();
+		v = (int32_t)(plantT * 1024.0 / 2560.0 + 0.5);
+	}
+	if (noiseLsb) {
+		lcg = lcg * 1103515245u + 12345u;
+		v += (int32_t)((lcg >> 16) % (2 * noiseLsb + 1)) - noiseLsb;
+	}
+	return v < 0 ? 0 : v > 1023 ? 1023 : v;
+}
+
+// Byte enters the shift register
+static void uart_shift(uint8_t byte)
+{
+	uartDone = sim_now + uartFrame;
+	uartShift = byte;
+	uartBytes++;
+}
+
+// Stop bit is out, the sink gets the byte unless the shifting stalled
+static void uart_sent()
+{
+	uartDone = NEVER;
+	if (uartStalled) {
+		uartStalled = 0;
+		uartCorrupt++;
+		return;
+	}
+	if (uartFd >= 0 && write(uartFd, &uartShift, 1) != 1) {
+		perror("uart");
+		uartFd = -1;
+	}
+}
+
+static void ee_save()
+{
+	FILE *f;
+	
+	if (!eeFile) return;
+	if (!(f = fopen(eeFile, "wb")) || fwrite(eeMem, 1, sizeof(eeMem), f) != sizeof(eeMem)) perror(eeFile);
+	if (f) fclose(f);
+}
+
+static void adc_start()
+{
+	adcCh = adcMux;
+	adcDone = sim_now + adcConv;
+}
+
+/*
+** Simulator side
+*/
+
+void sim_hal_reset()
+{
+	outputs = 0;
+	fanDuty = 0;
+	memset(eeMem, 0xFF, sizeof(eeMem));
+}
+
+uint64_t sim_hal_next()
+{
+	uint64_t t = adcDone;
+	
+	if (eeDone < t) t = eeDone;
+	
+	if (!sim_timers_stopped()) {
+		if (t0Next < t) t = t0Next;
+		if (t1Next < t) t = t1Next;
+		if (t2Next < t) t = t2Next;
+		if (uartDone < t) t = uartDone;
+	}
+	if (rxNext < t) t = rxNext;
+	return t;
+}
+
+void sim_hal_event()
+{
+	if (!sim_timers_stopped()) {
+		if (t0Next <= sim_now) {
+			t0Next += t0Period;
+			sim_irq_raise(SIM_VEC_TIMER0_COMP);
+		}
+		if (t1Next <= sim_now) {
+			t1Next += 256 * HAL_STAMP_CYCLES;
+			sim_irq_raise(SIM_VEC_TIMER1_OVF);
+		}
+		if (t2Next <= sim_now) {
+			t2Next += t2Period;
+			sim_irq_raise(SIM_VEC_TIMER2_COMP);
+		}
+		if (uartDone <= sim_now) {
+			uart_sent();
+			if (uartBufFull) {
+				uartBufFull = 0;
+				uart_shift(uartBuf);
+				sim_irq_raise(SIM_VEC_USART_UDRE);
+			}
+		}
+	}
+	if (rxNext <= sim_now) {
+		if (sim_timers_stopped() || rxStalled) {
+			rxStalled = 0;
+			rxLost++;
+			rxPos++;
+		} else {
+			if (sim_irq_pending(SIM_VEC_USART_RXC)) sim_log("uart: receive overrun");
+			rxData = rxText[rxPos++];
+			sim_irq_raise(SIM_VEC_USART_RXC);
+		}
+		rxNext = rxPos < rxLen ? sim_now + uartFrame : NEVER;
+	}
+	if (eeDone <= sim_now) {
+		eeDone = NEVER;
+		ee_save();
+		sim_irq_raise(SIM_VEC_EE_RDY);
+	}
+	if (adcDone <= sim_now) {
+		adcResult = adc_sample(adcCh);
+		adcDone = NEVER;
+		if (adcFreeRun) adc_start();
+		sim_irq_raise(SIM_VEC_ADC);
+	}
+}
+
+// Entering ADC Noise Reduction sleep starts a conversion, returns 1 when the
+// timers stop. USART bytes on the line at that moment are broken.
+uint8_t sim_hal_adc_sleep_start()
+{
+	if (!adcOn) return 0;
+	if (adcDone == NEVER) adc_start();
+	if (uartDone != NEVER) uartStalled = 1;
+	if (rxNext != NEVER) rxStalled = 1;
+	return 1;
+}
+
+void sim_hal_timers_shift(uint64_t cycles)
+{
+	if (t0Next != NEVER) t0Next += cycles;
+	if (t1Next != NEVER) t1Next += cycles;
+	if (t2Next != NEVER) t2Next += cycles;
+	if (uartDone != NEVER) uartDone += cycles;
+	t2Base += cycles;
+	t2Off += cycles;
+}
+
+void sim_hal_adc_input(uint8_t ch, uint16_t code)
+{
+	adcInput[ch & 7] = code;
+	if (ch == 0 && plantOn) plantT = code * 2560.0 / 1024.0;
+}
+
+void sim_hal_noise(uint8_t lsb)
+{
+	noiseLsb = lsb;
+}
+
+void sim_hal_key(uint8_t mask, uint64_t until)
+{
+	for (uint8_t i = 0; i < 4; i++)
+		if (mask & (1 << i)) keyUntil[i] = until;
+}
+
+void sim_hal_plant(int16_t ambient, int16_t heat, int16_t fan, uint16_t tau)
+{
+	plantOn = 1;
+	plantAmb = ambient;
+	plantHeat = heat;
+	plantFan = fan;
+	plantTau = tau ? tau : 1;
+	plantT = ambient;
+	plantLast = sim_now;
+}
+
+// Raw transmitted bytes go to fd, -1 drops them
+void sim_hal_uart_sink(int fd)
+{
+	uartFd = fd;
+}
+
+// Text the USART receives from now on, appended to what is still on its way
+void sim_hal_uart_rx(const char *text)
+{
+	if (rxPos == rxLen) rxPos = rxLen = 0;
+	while (*text && rxLen < sizeof(rxText)) rxText[rxLen++] = *text++;
+	if (rxNext == NEVER && rxPos < rxLen) rxNext = sim_now + uartFrame;
+}
+
+// EEPROM contents from an image file when it exists, every finished write
+// saves the image back
+void sim_hal_eeprom_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	
+	eeFile = path;
+	if (!f) return;
+	if (fread(eeMem, 1, sizeof(eeMem), f) != sizeof(eeMem)) sim_log("eeprom: %s is short", path);
+	fclose(f);
+}
+
+uint32_t sim_hal_eeprom_writes()
+{
+	return eeWrites;
+}
+
+uint32_t sim_hal_uart_bytes()
+{
+	return uartBytes;
+}
+
+// Transmitted bytes broken by a clkI/O stop
+uint32_t sim_hal_uart_corrupt()
+{
+	return uartCorrupt;
+}
+
+// Received bytes that arrived while clkI/O was stopped
+uint32_t sim_hal_uart_rx_lost()
+{
+	return rxLost;
+}
+
+void sim_hal_print_outputs()
+{
+	plant_update();
+	if (plantOn)
+		sim_log("out: heater %u fan %u duty %3u alarm %u  plant %.1f C", !!(outputs & HAL_OUT_HEATER),
+			!!(outputs & HAL_OUT_FAN), fanDuty, !!(outputs & HAL_OUT_ALARM), plantT / 10.0);
+	else
+		sim_log("out: heater %u fan %u duty %3u alarm %u", !!(outputs & HAL_OUT_HEATER),
+			!!(outputs & HAL_OUT_FAN), fanDuty, !!(outputs & HAL_OUT_ALARM));
+}
+
+/*
+** HAL
+*/
+
+void hal_init()
+{
+	plant_update();
+	outputs = 0;
+	fanDuty = 0;
+	t0Period = 1024UL * (HAL_TICK_OCR + 1);
+	t0Next = sim_now + t0Period;
+	sim_irq_enable(SIM_VEC_TIMER0_COMP, 1);
+}
+
+void hal_out_set(uint8_t mask)
+{
+	plant_update();
+	outputs |= mask;
+}
+
+void hal_out_clear(uint8_t mask)
+{
+	plant_update();
+	outputs &= ~mask;
+}
+
+uint8_t hal_keys()
+{
+	uint8_t keys = 0;
+	
+	for (uint8_t i = 0; i < 4; i++)
+		if (keyUntil[i] > sim_now) keys |= 1 << i;
+	return keys;
+}
+
+void hal_fan_pwm(uint8_t duty)
+{
+	plant_update();
+	fanDuty = duty;
+}
+
+// The pass is charged with interrupts still off, they run on the sei() or
+// wake the sleep
+void hal_idle(uint8_t sleep)
+{
+	sim_run(SIM_LOOP_CYCLES);
+	if (sleep) {
+		set_sleep_mode(SLEEP_MODE_IDLE);
+		sleep_enable();
+		sim_sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+	sim_sei();
+	sim_run(0);
+}
+
+// Called from the compare interrupt, t0Next is one old period ahead
+void hal_tick_stretch(uint8_t n)
+{
+	uint64_t p = 1024UL * (HAL_TICK_OCR + 1) * n;
+	
+	t0Next += p - t0Period;
+	t0Period = p;
+}
+
+uint16_t hal_tick_elapsed()
+{
+	uint16_t n = (sim_now - (t0Next - t0Period)) / 1024;
+	
+	if (sim_irq_pending(SIM_VEC_TIMER0_COMP)) n += t0Period / 1024;
+	return n;
+}
+
+uint8_t hal_tick_advance(uint8_t counts)
+{
+	uint16_t t = (sim_now - (t0Next - t0Period)) / 1024;
+	uint16_t ocr = t0Period / 1024 - 1;
+	uint16_t room = t < ocr ? ocr - 1 - t : 0;
+	
+	if (counts > room) counts = room;
+	t0Next -= counts * 1024UL;
+	return counts;
+}
+
+// Timer1 counts from reset, overflow events only while its interrupt is on
+void hal_stamp_init()
+{
+	t1Next = (sim_now / (256 * HAL_STAMP_CYCLES) + 1) * 256 * HAL_STAMP_CYCLES;
+	sim_irq_enable(SIM_VEC_TIMER1_OVF, 1);
+}
+
+uint8_t hal_stamp_timer(uint8_t *ovf)
+{
+	uint8_t t = sim_now / HAL_STAMP_CYCLES;
+	
+	*ovf = sim_irq_pending(SIM_VEC_TIMER1_OVF) && t < 0x80;
+	return t;
+}
+
+void hal_adc_init(uint8_t prescaler, uint8_t freeRun)
+{
+	adcOn = 1;
+	adcFreeRun = freeRun;
+	adcConv = 13UL << (prescaler ? prescaler : 1);
+	sim_irq_enable(SIM_VEC_ADC, 1);
+	if (freeRun) adc_start();
+}
+
+void hal_adc_mux(uint8_t ch)
+{
+	adcMux = ch;
+}
+
+uint16_t hal_adc_result()
+{
+	return adcResult;
+}
+
+void hal_adc_start()
+{
+	if (adcOn && adcDone == NEVER) adc_start();
+}
+
+void hal_lcd_init(uint8_t tickOcr)
+{
+	t2Period = 8UL * (tickOcr + 1);
+	t2Base = sim_now;
+	t2Off = sim_now;
+}
+
+void hal_lcd_nibble(uint8_t nibble, uint8_t rs)
+{
+	hd_nibble(nibble & 0x0F, rs);
+}
+
+// A compare match while the interrupt was off left the flag set
+void hal_lcd_tick(uint8_t on)
+{
+	if (on && t2Next == NEVER) {
+		if (t2Base + ((t2Off - t2Base) / t2Period + 1) * t2Period <= sim_now) sim_irq_raise(SIM_VEC_TIMER2_COMP);
+		t2Next = t2Base + ((sim_now - t2Base) / t2Period + 1) * t2Period;
+	} else if (!on && t2Next != NEVER) {
+		t2Next = NEVER;
+		t2Off = sim_now;
+		sim_irq_clear(SIM_VEC_TIMER2_COMP);
+	}
+	sim_irq_enable(SIM_VEC_TIMER2_COMP, on);
+}
+
+// UDRE is set out of reset
+void hal_uart_init(uint16_t ubrr)
+{
+	uartFrame = 16UL * (ubrr + 1) * 10;
+	uartBufFull = 0;
+	sim_irq_raise(SIM_VEC_USART_UDRE);
+	sim_irq_enable(SIM_VEC_USART_RXC, 1);
+}
+
+void hal_uart_tx_irq(uint8_t on)
+{
+	if (on && !uartBufFull) sim_irq_raise(SIM_VEC_USART_UDRE);
+	sim_irq_enable(SIM_VEC_USART_UDRE, on);
+}
+
+void hal_uart_tx(uint8_t byte)
+{
+	if (uartDone == NEVER) {
+		uart_shift(byte);
+		sim_irq_raise(SIM_VEC_USART_UDRE);
+	} else if (!uartBufFull) {
+		uartBuf = byte;
+		uartBufFull = 1;
+		sim_irq_clear(SIM_VEC_USART_UDRE);
+	} else sim_log("uart: UDR written while full, byte lost");
+}
+
+uint8_t hal_uart_rx()
+{
+	sim_irq_clear(SIM_VEC_USART_RXC);
+	return rxData;
+}
+
+uint8_t hal_eeprom_read(uint16_t addr)
+{
+	if (eeDone != NEVER) {
+		sim_log("eeprom: read waits for a running write");
+		sim_run(eeDone - sim_now);
+	}
+	return eeMem[addr % HAL_EEPROM_SIZE];
+}
+
+void hal_eeprom_write(uint16_t addr, uint8_t byte)
+{
+	if (eeDone != NEVER) {
+		sim_log("eeprom: write started while busy, byte lost");
+		return;
+	}
+	eeMem[addr % HAL_EEPROM_SIZE] = byte;
+	eeWrites++;
+	eeDone = sim_now + SIM_US(SIM_EE_WRITE_US);
+	sim_irq_clear(SIM_VEC_EE_RDY);
+}
+
+void hal_eeprom_irq(uint8_t on)
+{
+	if (on && eeDone == NEVER) sim_irq_raise(SIM_VEC_EE_RDY);
+	sim_irq_enable(SIM_VEC_EE_RDY, on);
+}
@@ -0,0 +1,129 @@
+/*
+ * hd44780.c
+ *
+ * Virtual 16x2 HD44780 on a 4-bit bus. Follows the power-on 8-bit mode,
+ * function set, DDRAM/CGRAM addressing and counts writes that arrive while
+ * the controller is still busy (37 us per command, 1.52 ms for clear/home).
+ */ 
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define HD_COLS		16
+#define HD_BUSY		SIM_US(37)
+#define HD_BUSY_CLR	SIM_US(1520)
+
+static uint8_t ddram[0x80];
+static uint8_t cgram[0x40];
+static uint8_t addr;
+static uint8_t cgMode;
+static uint8_t bus8;			// 8-bit interface, one nibble per write
+static uint8_t highNibble;		// first half of a 4-bit transfer
+static uint8_t pending;
+static uint8_t dispOn;
+static uint64_t busyUntil;
+static uint32_t violations;
+
+static void next_addr()
+{
+	if (cgMode) {
+		addr = (addr + 1) & 0x3F;
+		return;
+	}
+	addr++;
+	if (addr == 0x28) addr = 0x40;
+	else if (addr == 0x68) addr = 0x00;
+}
+
+static void command(uint8_t c)
+{
+	uint64_t busy = HD_BUSY;
+	
+	if (c == 0x01) {
+		memset(ddram, ' ', sizeof(ddram));
+		addr = 0;
+		cgMode = 0;
+		busy = HD_BUSY_CLR;
+	} else if ((c & 0xFE) == 0x02) {
+		addr = 0;
+		cgMode = 0;
+		busy = HD_BUSY_CLR;
+	} else if ((c & 0xF8) == 0x08) {
+		dispOn = (c >> 2) & 1;
+	} else if ((c & 0xE0) == 0x20) {
+		bus8 = (c >> 4) & 1;
+	} else if ((c & 0xC0) == 0x40) {
+		addr = c & 0x3F;
+		cgMode = 1;
+	} else if (c & 0x80) {
+		addr = c & 0x7F;
+		cgMode = 0;
+	}
+	busyUntil = sim_now + busy;
+}
+
+static void data(uint8_t d)
+{
+	if (cgMode) cgram[addr] = d;
+	else ddram[addr] = d;
+	next_addr();
+	busyUntil = sim_now + HD_BUSY;
+}
+
+void hd_reset()
+{
+	memset(ddram, ' ', sizeof(ddram));
+	memset(cgram, 0, sizeof(cgram));
+	addr = 0;
+	cgMode = 0;
+	bus8 = 1;
+	highNibble = 1;
+	dispOn = 0;
+	busyUntil = 0;
+	violations = 0;
+}
+
+void hd_nibble(uint8_t nibble, uint8_t rs)
+{
+	if (sim_now < busyUntil) {
+		if (!violations) sim_log("lcd: write %u us early", (unsigned)((busyUntil - sim_now) * 1000000 / F_CPU));
+		violations++;
+	}
+	if (bus8) {
+		// DB3..0 are not connected and read as 0
+		if (rs) data(nibble << 4);
+		else command(nibble << 4);
+		highNibble = 1;
+		return;
+	}
+	if (highNibble) {
+		pending = nibble << 4;
+		highNibble = 0;
+		return;
+	}
+	highNibble = 1;
+	if (rs) data(pending | nibble);
+	else command(pending | nibble);
+}
+
+// Custom characters show as '*', the degree sign as 'o', anything else outside printable ASCII as '?'
+void hd_print()
+{
+	char line[2][HD_COLS + 1];
+	
+	for (uint8_t y = 0; y < 2; y++) {
+		for (uint8_t x = 0; x < HD_COLS; x++) {
+			uint8_t c = ddram[y * 0x40 + x];
+			line[y][x] = c < 8 ? '*' : c == 0xDF ? 'o' : (c >= 0x20 && c < 0x7E) ? c : '?';
+		}
+		line[y][HD_COLS] = 0;
+	}
+	sim_log("lcd: |%s|%s", line[0], dispOn ? "" : " (off)");
+	sim_log("lcd: |%s|", line[1]);
+}
+
+uint32_t hd_violations()
+{
+	return violations;
+}
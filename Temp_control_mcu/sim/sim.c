@@ -0,0 +1,405 @@
+/*
+ * sim.c
+ *
+ * Host simulator core: cycle clock, interrupt dispatch, input script and
+ * the entry point that runs the unchanged firmware main()
+ */ 
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "avr/sleep.h"
+
+int app_main(void);
+void instr_dump(void (*out)(char)) __attribute__((weak));
+
+// Handlers the firmware does not define stay NULL
+void INT0_vect(void) __attribute__((weak));
+void TIMER2_COMP_vect(void) __attribute__((weak));
+void TIMER1_OVF_vect(void) __attribute__((weak));
+void USART_RXC_vect(void) __attribute__((weak));
+void USART_UDRE_vect(void) __attribute__((weak));
+void ADC_vect(void) __attribute__((weak));
+void EE_RDY_vect(void) __attribute__((weak));
+void TIMER0_COMP_vect(void) __attribute__((weak));
+
+static void (*handler[SIM_VECTORS])(void);
+
+uint64_t sim_now = 0;
+uint8_t sim_sleep_mode = 0;
+uint8_t sim_sleep_enabled = 0;
+
+static uint8_t ie = 0;						// global interrupt flag
+static uint8_t irqEnabled[SIM_VECTORS];
+static uint8_t irqPending[SIM_VECTORS];
+static uint32_t irqCount[SIM_VECTORS];
+static uint8_t sleeping = 0;				// in ADC Noise Reduction sleep, timers stopped
+static uint8_t isrDepth = 0;
+
+/*
+** Input script
+*/
+
+typedef struct{
+	uint64_t at;
+	char cmd[16];
+	double arg[4];
+	int argc;
+	char text[48];		// rest of the line after the step name
+}step_t;
+
+static step_t *script = NULL;
+static int steps = 0;
+static int nextStep = 0;
+static uint64_t wallStart;
+
+static uint64_t wall_us()
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void sim_log(const char *fmt, ...)
+{
+	va_list ap;
+	
+	printf("%10.3f  ", (double)sim_now * 1000.0 / F_CPU);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	putchar('\n');
+}
+
+static void finish(int code)
+{
+	uint64_t wall = wall_us() - wallStart;
+	double simSec = (double)sim_now / F_CPU;
+	
+	sim_log("end: %.1f s simulated in %.3f s, %.0fx real time", simSec, wall / 1e6, wall ? simSec * 1e6 / wall : 0.0);
+	sim_log("irqs: timer0 %u timer2 %u adc %u", irqCount[SIM_VEC_TIMER0_COMP],
+		irqCount[SIM_VEC_TIMER2_COMP], irqCount[SIM_VEC_ADC]);
+	sim_log("lcd timing violations: %u", hd_violations());
+	sim_log("uart: %u bytes sent, %u udre irqs", sim_hal_uart_bytes(), irqCount[SIM_VEC_USART_UDRE]);
+	sim_log("uart: %u sent and %u received bytes broken by ADC sleep", sim_hal_uart_corrupt(), sim_hal_uart_rx_lost());
+	sim_log("eeprom: %u bytes written", sim_hal_eeprom_writes());
+	exit(code);
+}
+
+static void load_script(FILE *f)
+{
+	char line[128];
+	int n = 0;
+	
+	while (fgets(line, sizeof(line), f)) {
+		step_t s;
+		double ms;
+		int rest = 0;
+		char *p = strchr(line, '#');
+		
+		if (p) *p = 0;
+		memset(&s, 0, sizeof(s));
+		n = sscanf(line, "%lf %15s %lf %lf %lf %lf", &ms, s.cmd, &s.arg[0], &s.arg[1], &s.arg[2], &s.arg[3]);
+		if (n < 2) continue;
+		sscanf(line, "%*f %*s %n", &rest);
+		if (rest) sscanf(line + rest, "%47[^\n]", s.text);
+		s.at = SIM_US(ms * 1000.0);
+		s.argc = n - 2;
+		script = realloc(script, (steps + 1) * sizeof(step_t));
+		script[steps++] = s;
+	}
+}
+
+// Line buffered output for firmware text dumps
+static void put_line(char c)
+{
+	static char line[96];
+	static uint8_t n;
+	
+	if (c != '\n' && n < sizeof(line) - 1) {
+		line[n++] = c;
+		return;
+	}
+	line[n] = 0;
+	n = 0;
+	sim_log("%s", line);
+}
+
+static void run_step(const step_t *s)
+{
+	if (!strcmp(s->cmd, "adc") && s->argc >= 2) {
+		sim_hal_adc_input((uint8_t)s->arg[0], (uint16_t)s->arg[1]);
+	} else if (!strcmp(s->cmd, "temp") && s->argc >= 1) {
+		// TMP35: 10 mV/C at 2.56 V full scale
+		sim_hal_adc_input(0, (uint16_t)(s->arg[0] * 10.0 * 1024.0 / 2560.0 + 0.5));
+	} else if (!strcmp(s->cmd, "noise") && s->argc >= 1) {
+		sim_hal_noise((uint8_t)s->arg[0]);
+	} else if (!strcmp(s->cmd, "key") && s->argc >= 1) {
+		sim_hal_key(1 << ((int)s->arg[0] - 1), sim_now + SIM_MS(s->argc > 1 ? s->arg[1] : SIM_KEY_MS));
+	} else if (!strcmp(s->cmd, "mode")) {
+		sim_hal_key(1 << 3, sim_now + SIM_MS(s->argc > 0 ? s->arg[0] : SIM_KEY_MS));
+	} else if (!strcmp(s->cmd, "plant") && s->argc >= 4) {
+		sim_hal_plant(s->arg[0] * 10, s->arg[1] * 10, s->arg[2] * 10, s->arg[3]);
+	} else if (!strcmp(s->cmd, "uart")) {
+		char line[sizeof(s->text) + 1];
+		
+		snprintf(line, sizeof(line), "%s\n", s->text);
+		sim_hal_uart_rx(line);
+	} else if (!strcmp(s->cmd, "lcd")) {
+		hd_print();
+	} else if (!strcmp(s->cmd, "out")) {
+		sim_hal_print_outputs();
+	} else if (!strcmp(s->cmd, "instr")) {
+		if (instr_dump) instr_dump(put_line);
+		else sim_log("instr: build with INSTRUMENT=1");
+	} else if (!strcmp(s->cmd, "end")) {
+		finish(0);
+	} else {
+		sim_log("script: bad step '%s'", s->cmd);
+		finish(2);
+	}
+}
+
+/*
+** Interrupts
+*/
+
+void sim_sei()
+{
+	ie = 1;
+}
+
+void sim_cli()
+{
+	ie = 0;
+}
+
+uint8_t sim_irq_save()
+{
+	return ie;
+}
+
+void sim_irq_restore(uint8_t sreg)
+{
+	ie = sreg;
+}
+
+void sim_irq_enable(uint8_t vec, uint8_t on)
+{
+	irqEnabled[vec] = on;
+}
+
+void sim_irq_raise(uint8_t vec)
+{
+	irqPending[vec] = 1;
+}
+
+void sim_irq_clear(uint8_t vec)
+{
+	irqPending[vec] = 0;
+}
+
+uint8_t sim_irq_pending(uint8_t vec)
+{
+	return irqPending[vec];
+}
+
+// Run pending handlers by priority, I is cleared inside and set again by RETI
+static void dispatch()
+{
+	uint8_t v;
+	
+	while (ie) {
+		for (v = 1; v < SIM_VECTORS; v++)
+			if (irqPending[v] && irqEnabled[v]) break;
+		if (v == SIM_VECTORS) return;
+		irqPending[v] = 0;
+		irqCount[v]++;
+		if (!handler[v]) {
+			sim_log("irq %u enabled without handler", v);
+			finish(3);
+		}
+		ie = 0;
+		isrDepth++;
+		handler[v]();
+		isrDepth--;
+		ie = 1;
+	}
+}
+
+/*
+** Clock
+*/
+
+static uint64_t next_event()
+{
+	uint64_t t = sim_hal_next();
+	
+	if (nextStep < steps && script[nextStep].at < t) t = script[nextStep].at;
+	return t;
+}
+
+// The run ends after the last script step
+static void run_events()
+{
+	while (nextStep < steps && script[nextStep].at <= sim_now) {
+		run_step(&script[nextStep++]);
+		if (nextStep == steps) finish(0);
+	}
+	sim_hal_event();
+}
+
+void sim_run(uint64_t cycles)
+{
+	uint64_t target = sim_now + cycles;
+	
+	while (1) {
+		dispatch();
+		uint64_t t = next_event();
+		if (t > target) break;
+		if (t > sim_now) sim_now = t;
+		run_events();
+	}
+	if (target > sim_now) sim_now = target;
+}
+
+// Wake on the next interrupt that can run
+void sim_sleep()
+{
+	uint64_t start = sim_now;
+	
+	if (!sim_sleep_enabled) return;
+	if (!ie) {
+		sim_log("sleep with interrupts disabled never wakes");
+		finish(3);
+	}
+	if (sim_sleep_mode == SLEEP_MODE_ADC) sleeping = sim_hal_adc_sleep_start();
+	while (1) {
+		for (uint8_t v = 1; v < SIM_VECTORS; v++)
+			if (irqPending[v] && irqEnabled[v]) goto wake;
+		uint64_t t = next_event();
+		if (t == UINT64_MAX) {
+			sim_log("sleep without wake-up source");
+			finish(3);
+		}
+		if (t > sim_now) sim_now = t;
+		run_events();
+	}
+wake:
+	if (sleeping) {
+		sleeping = 0;
+		sim_hal_timers_shift(sim_now - start);
+	}
+	dispatch();
+}
+
+uint8_t sim_timers_stopped()
+{
+	return sleeping;
+}
+
+uint8_t sim_in_isr()
+{
+	return isrDepth != 0;
+}
+
+/*
+** avr-libc conversions missing on the host
+*/
+
+char *utoa(unsigned int val, char *s, int radix)
+{
+	char tmp[17];
+	int i = 0, j = 0;
+	
+	do {
+		unsigned d = val % radix;
+		tmp[i++] = d < 10 ? '0' + d : 'a' + d - 10;
+		val /= radix;
+	} while (val);
+	while (i) s[j++] = tmp[--i];
+	s[j] = 0;
+	return s;
+}
+
+char *itoa(int val, char *s, int radix)
+{
+	if (val < 0 && radix == 10) {
+		s[0] = '-';
+		utoa(-(unsigned)val, s + 1, radix);
+	} else utoa((unsigned)val & 0xFFFF, s, radix);
+	return s;
+}
+
+char *ultoa(unsigned long val, char *s, int radix)
+{
+	return utoa((uint32_t)val, s, radix);
+}
+
+char *ltoa(long val, char *s, int radix)
+{
+	if (val < 0 && radix == 10) {
+		s[0] = '-';
+		ultoa(-val, s + 1, radix);
+		return s;
+	}
+	return ultoa(val, s, radix);
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: temp_control_sim [-u uart_out] [-e eeprom_image] [script]\n"
+		"  -u PATH  write the transmitted USART bytes to a file, fifo or pty\n"
+		"  -e PATH  EEPROM contents, loaded when the file exists and saved after every write\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f = stdin;
+	int opt, fd;
+	
+	sim_hal_reset();
+	while ((opt = getopt(argc, argv, "u:e:")) != -1) {
+		if (opt == 'e') {
+			sim_hal_eeprom_file(optarg);
+			continue;
+		}
+		if (opt != 'u') usage();
+		if ((fd = open(optarg, O_WRONLY | O_CREAT | O_TRUNC | O_NOCTTY, 0644)) < 0) {
+			perror(optarg);
+			return 1;
+		}
+		sim_hal_uart_sink(fd);
+		// a reader that goes away only ends the stream
+		signal(SIGPIPE, SIG_IGN);
+	}
+	if (argc - optind > 1) usage();
+	if (optind < argc && !(f = fopen(argv[optind], "r"))) {
+		perror(argv[optind]);
+		return 1;
+	}
+	load_script(f);
+	
+	handler[SIM_VEC_INT0] = INT0_vect;
+	handler[SIM_VEC_TIMER2_COMP] = TIMER2_COMP_vect;
+	handler[SIM_VEC_TIMER1_OVF] = TIMER1_OVF_vect;
+	handler[SIM_VEC_USART_RXC] = USART_RXC_vect;
+	handler[SIM_VEC_USART_UDRE] = USART_UDRE_vect;
+	handler[SIM_VEC_ADC] = ADC_vect;
+	handler[SIM_VEC_EE_RDY] = EE_RDY_vect;
+	handler[SIM_VEC_TIMER0_COMP] = TIMER0_COMP_vect;
+	
+	hd_reset();
+	wallStart = wall_us();
+	app_main();
+	finish(0);
+	return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * sim.h
+ *
+ * Host simulator core shared by the avr-libc shims, the HAL backend and the
+ * virtual display. Time is counted in CPU cycles at F_CPU, interrupts are
+ * dispatched by vector number like on the ATmega16.
+ */ 
+#ifndef SIM_H
+#define SIM_H
+
+#include <inttypes.h>
+
+#ifndef F_CPU
+#define F_CPU 7372800UL
+#endif
+
+// ATmega16 interrupt vector numbers
+#define SIM_VEC_INT0		1
+#define SIM_VEC_TIMER2_COMP	3
+#define SIM_VEC_TIMER1_OVF	8
+#define SIM_VEC_USART_RXC	11
+#define SIM_VEC_USART_UDRE	12
+#define SIM_VEC_ADC			14
+#define SIM_VEC_EE_RDY		15
+#define SIM_VEC_TIMER0_COMP	19
+#define SIM_VECTORS			21
+
+#define SIM_US(us)	((uint64_t)(us) * F_CPU / 1000000UL)
+#define SIM_MS(ms)	((uint64_t)(ms) * F_CPU / 1000UL)
+
+#define SIM_KEY_MS	100		// default key press length of the script
+
+extern uint64_t sim_now;		// cycles since reset
+
+// Global interrupt flag
+void sim_sei();
+void sim_cli();
+uint8_t sim_irq_save();
+void sim_irq_restore(uint8_t sreg);
+
+// Interrupt sources, a raised vector runs once it is enabled and I is set
+void sim_irq_enable(uint8_t vec, uint8_t on);
+void sim_irq_raise(uint8_t vec);
+void sim_irq_clear(uint8_t vec);
+uint8_t sim_irq_pending(uint8_t vec);
+
+// Advance time, running due events and interrupts on the way
+void sim_run(uint64_t cycles);
+void sim_sleep();
+uint8_t sim_timers_stopped();
+uint8_t sim_in_isr();
+
+// Peripheral models in hal_sim.c
+void sim_hal_reset();
+uint64_t sim_hal_next();
+void sim_hal_event();
+uint8_t sim_hal_adc_sleep_start();
+void sim_hal_timers_shift(uint64_t cycles);
+void sim_hal_adc_input(uint8_t ch, uint16_t code);
+void sim_hal_noise(uint8_t lsb);
+void sim_hal_key(uint8_t mask, uint64_t until);
+void sim_hal_plant(int16_t ambient, int16_t heat, int16_t fan, uint16_t tau);
+void sim_hal_uart_sink(int fd);
+void sim_hal_uart_rx(const char *text);
+uint32_t sim_hal_uart_bytes();
+uint32_t sim_hal_uart_corrupt();
+uint32_t sim_hal_uart_rx_lost();
+void sim_hal_eeprom_file(const char *path);
+uint32_t sim_hal_eeprom_writes();
+void sim_hal_print_outputs();
+
+// Virtual HD44780 in hd44780.c
+void hd_reset();
+void hd_nibble(uint8_t nibble, uint8_t rs);
+void hd_print();
+uint32_t hd_violations();
+
+// Line prefix with the simulated time
+void sim_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif //SIM_H
@@ -0,0 +1,21 @@
+/*
+ * util/atomic.h
+ *
+ * Host shim of the avr-libc ATOMIC_BLOCK, the cleanup handler restores the
+ * interrupt flag on every way out of the block
+ */ 
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include "../sim.h"
+
+static inline uint8_t __sim_atomic_on(void) { sim_cli(); return 1; }
+static inline void __sim_restore(const uint8_t *sreg) { sim_irq_restore(*sreg); }
+static inline void __sim_force_on(const uint8_t *sreg) { (void)sreg; sim_sei(); }
+
+#define ATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(__sim_restore))) = sim_irq_save()
+#define ATOMIC_FORCEON uint8_t sreg_save __attribute__((__cleanup__(__sim_force_on))) = 0
+
+#define ATOMIC_BLOCK(type) for (type, __todo = __sim_atomic_on(); __todo; __todo = 0)
+
+#endif //SIM_UTIL_ATOMIC_H
@@ -0,0 +1,21 @@
+/*
+ * util/crc16.h
+ *
+ * Host shim of the avr-libc CRC helpers used by the firmware, same results
+ * as the optimized inline assembly
+ */ 
+#ifndef SIM_UTIL_CRC16_H
+#define SIM_UTIL_CRC16_H
+
+#include <inttypes.h>
+
+// Polynomial 0x1021, MSB first
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+	crc ^= (uint16_t)data << 8;
+	for (uint8_t i = 0; i < 8; i++)
+		crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	return crc;
+}
+
+#endif //SIM_UTIL_CRC16_H
@@ -0,0 +1,14 @@
+/*
+ * util/delay.h
+ *
+ * Host shim: busy waits advance simulated time, interrupts keep running
+ */ 
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include "../sim.h"
+
+#define _delay_us(us) sim_run(SIM_US(us))
+#define _delay_ms(ms) sim_run(SIM_MS(ms))
+
+#endif //SIM_UTIL_DELAY_H
@@ -0,0 +1,59 @@
+/*
+ * stack.c
+ *
+ * Stack painting and high-water mark scan
+ */ 
+#include "stack.h"
+
+#ifndef HAL_SIM
+
+extern uint8_t _end;		// end of .bss/.noinit, no heap in this firmware
+extern uint8_t __stack;		// RAMEND, where the stack starts
+
+// Runs straight from the reset code, r1 is not zeroed and SP not set yet,
+// so plain asm without a frame. Falls through into .init2.
+void stack_paint() __attribute__((naked, used, section(".init1")));
+void stack_paint()
+{
+	__asm__ volatile(
+		"	ldi r30, lo8(_end)\n"
+		"	ldi r31, hi8(_end)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		"	breq 1b\n"
+		:: "M" (STACK_CANARY));
+}
+
+// Bytes above .bss the stack has not reached since reset
+uint16_t stack_free()
+{
+	const uint8_t *p = &_end;
+	
+	while (p <= &__stack && *p == STACK_CANARY) p++;
+	return p - &_end;
+}
+
+// Deepest stack use since reset in bytes, ISRs included
+uint16_t stack_used()
+{
+	return &__stack - &_end + 1 - stack_free();
+}
+
+#else
+
+uint16_t stack_free()
+{
+	return STACK_UNKNOWN;
+}
+
+uint16_t stack_used()
+{
+	return STACK_UNKNOWN;
+}
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * stack.h
+ *
+ * Stack high-water mark. The RAM between the end of .bss and RAMEND is
+ * painted with STACK_CANARY in .init1, before the stack pointer is set up,
+ * and stack_free() counts the painted bytes from the bottom that the stack
+ * has never overwritten since reset. The scan stops at the first used byte,
+ * so it costs ~6 cycles per free byte. bench/stack_budget.sh checks the
+ * static worst case against a budget at build time.
+ */ 
+#ifndef STACK_H
+#define STACK_H
+
+#include <inttypes.h>
+
+#define STACK_CANARY	0xC5
+#define STACK_UNKNOWN	0xFFFF		// host simulation, no AVR stack to scan
+
+uint16_t stack_free();
+uint16_t stack_used();
+
+#endif //STACK_H
@@ -0,0 +1,108 @@
+/*
+ * telem.c
+ *
+ * Telemetry frame builder on top of the UART transmit ring
+ */ 
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+#include "telem.h"
+#include "uart.h"
+
+#if TELEM_MAX_PAYLOAD + TELEM_OVERHEAD >= UART_TX_SIZE
+#error "TELEM_MAX_PAYLOAD frames do not fit the UART ring"
+#endif
+
+// Frame pacing, ticks set by telem_tick() from the Timer0 interrupt
+static volatile uint8_t period = TELEM_TICKS;
+static volatile uint8_t due = 0;
+static uint8_t ticks = 0;
+
+// Frame being built, main loop only
+static uint8_t seq = 0;
+static uint16_t crc;
+static uint16_t dropped = 0;
+
+void telem_init()
+{
+	uart_init();
+}
+
+// Status frame period in Timer0 ticks, 0 stops the stream
+void telem_period(uint8_t t)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		period = t;
+		ticks = 0;
+		due = 0;
+	}
+}
+
+// Call from the Timer0 ISR
+void telem_tick()
+{
+	if (!period) return;
+	if (++ticks >= period) {
+		ticks = 0;
+		due = 1;
+	}
+}
+
+// Returns 1 once per period, the main loop then sends a status frame
+uint8_t telem_due()
+{
+	if (!due) return 0;
+	due = 0;
+	return 1;
+}
+
+// Returns 1 when a frame of len payload bytes fits the ring right now
+uint8_t telem_fits(uint8_t len)
+{
+	return len <= TELEM_MAX_PAYLOAD && uart_reserve(len + TELEM_OVERHEAD);
+}
+
+// Start a frame of len payload bytes, returns 0 and counts the frame as
+// dropped when the ring cannot take all of it right now
+uint8_t telem_begin(uint8_t type, uint8_t len)
+{
+	if (len > TELEM_MAX_PAYLOAD || !uart_reserve(len + TELEM_OVERHEAD)) {
+		seq++;
+		dropped++;
+		return 0;
+	}
+	uart_put(TELEM_SYNC);
+	crc = 0xFFFF;
+	telem_put8(type);
+	telem_put8(seq++);
+	telem_put8(len);
+	return 1;
+}
+
+void telem_put8(uint8_t v)
+{
+	crc = _crc_xmodem_update(crc, v);
+	uart_put(v);
+}
+
+void telem_put16(uint16_t v)
+{
+	telem_put8(v);
+	telem_put8(v >> 8);
+}
+
+// Append the CRC and hand the frame to the transmitter
+void telem_end()
+{
+	uint16_t c = crc;
+	
+	uart_put(c);
+	uart_put(c >> 8);
+	uart_commit();
+}
+
+// Frames not sent because the ring was full
+uint16_t telem_dropped()
+{
+	return dropped;
+}
@@ -0,0 +1,65 @@
+/*
+ * telem.h
+ *
+ * Framed binary telemetry over the USART transmitter. A frame is
+ *   sync, type, seq, len, payload[len], CRC-16 low byte, CRC-16 high byte
+ * with CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) over type..payload and
+ * little-endian payload fields. seq also counts frames dropped for lack of
+ * ring space, so a receiver sees the gaps. Payload values are put straight
+ * into the UART ring with the CRC updated on the way, no frame buffer.
+ */ 
+#ifndef TELEM_H
+#define TELEM_H
+
+#include <inttypes.h>
+
+#define TELEM_SYNC			0xA5
+#define TELEM_OVERHEAD		6		// bytes around the payload
+#define TELEM_MAX_PAYLOAD	32
+
+// Status frame period in Timer0 ticks (~98.6 Hz), 0 stops the stream
+#define TELEM_TICKS			50		// ~2 frames/s, ~61 B/s of 3840 B/s at 38400 baud
+
+// Frame types
+#define TELEM_STATUS		0x01
+#define TELEM_TEXT			0x02	// ASCII reply to a UART command, no terminator
+#define TELEM_HIST_HEAD		0x03	// history export, see hist.h
+#define TELEM_HIST_DATA		0x04
+
+// TELEM_STATUS payload
+//   int16  temperature in 0.1 C, filtered
+//   uint16 last unfiltered ADC sample of the sensor (ADC_RESULT_BITS wide)
+//   int16  set temperature in 0.1 C
+//   int16  controller output, -255 (full fan) .. 255 (full heat)
+//   uint8  fan PWM duty
+//   uint8  working mode
+//   uint8  flags below
+//   uint16 free RAM, bytes above .bss the stack never reached (stack.h),
+//          0xFFFF in the host simulation
+//   uint16 wakeups from idle sleep per second (idle.h)
+//   uint8  percent of the time in idle sleep
+//   uint8  LCD queue high-water mark, most bytes ever waiting (lcd.h)
+//   uint16 LCD bytes dropped because the queue was full
+//   uint16 ADC samples lost because the main loop fell behind (adc.h)
+//   uint16 received bytes lost because the RX ring was full (uart.h)
+//   uint16 frames dropped because the TX ring was full, the seq gaps
+#define TELEM_STATUS_LEN	25
+#define TELEM_F_HEATER		(1 << 0)	// heater output on right now
+#define TELEM_F_FAN			(1 << 1)	// fan enabled
+#define TELEM_F_ALARM		(1 << 2)	// alarm output on
+#define TELEM_F_ALARM_USE	(1 << 3)	// alarm enabled in the menu
+#define TELEM_F_LOCK		(1 << 4)	// menu locked while the output is active
+#define TELEM_F_SAVING		(1 << 5)	// EEPROM save running (eeconf.h)
+
+void telem_init();
+void telem_period(uint8_t ticks);
+void telem_tick();
+uint8_t telem_due();
+uint8_t telem_fits(uint8_t len);
+uint8_t telem_begin(uint8_t type, uint8_t len);
+void telem_put8(uint8_t v);
+void telem_put16(uint16_t v);
+void telem_end();
+uint16_t telem_dropped();
+
+#endif //TELEM_H
@@ -0,0 +1,216 @@
+/*
+ * telem_decode.c
+ *
+ * Linux decoder for the telemetry frames in telem.h. Reads a serial port
+ * (set to raw 38400 8N1), a pty, a fifo or a capture file and prints one
+ * CSV line per status frame, command replies as '# ' comment lines and a
+ * history export (cmd 'h') as "hist,<seconds before now>,<temp>,<heater>,
+ * <fan>,<alarm>" lines, oldest first;
+ * CRC errors, sequence gaps and skipped bytes go to stderr. On a serial
+ * port or pty, lines typed on stdin are sent as commands (cmd.h), each led
+ * by a newline and a WAKE_MS pause: the firmware may have the USART clock
+ * stopped for an ADC round, the newline can be lost but the round ends and
+ * the next ones leave the USART running.
+ *
+ *   telem_decode /dev/ttyUSB0
+ *   echo v2=24 | telem_decode /dev/ttyUSB0
+ *   temp_control_sim -u telem.bin example.sim && telem_decode telem.bin
+ */ 
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../telem.h"
+#include "../hist.h"
+
+#define WAKE_MS		10		// longer than one ADC Noise Reduction round
+
+static unsigned long frames, crcErrors, lost, skipped;
+static int lastSeq = -1;
+
+// History export being collected
+static struct{
+	int active;
+	int16_t base;
+	unsigned records, bytes, period, age, lost, got;
+	uint8_t data[HIST_SIZE];
+}hist;
+
+static uint16_t crc16(const uint8_t *p, int n)
+{
+	uint16_t crc = 0xFFFF;
+	
+	while (n--) {
+		crc ^= (uint16_t)*p++ << 8;
+		for (int i = 0; i < 8; i++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static int16_t get16(const uint8_t *p)
+{
+	return (int16_t)(p[0] | p[1] << 8);
+}
+
+static void status(uint8_t seq, const uint8_t *p)
+{
+	uint8_t flags = p[10];
+	
+	uint16_t ram = get16(p + 11);
+	
+	printf("%u,%.1f,%u,%.1f,%d,%u,%u,%u,%u,%u,%u,%u,%u,", seq, get16(p) / 10.0, (uint16_t)get16(p + 2),
+		get16(p + 4) / 10.0, get16(p + 6), p[8], p[9], !!(flags & TELEM_F_HEATER), !!(flags & TELEM_F_FAN),
+		!!(flags & TELEM_F_ALARM), !!(flags & TELEM_F_ALARM_USE), !!(flags & TELEM_F_LOCK), !!(flags & TELEM_F_SAVING));
+	// empty when unknown (host simulation)
+	if (ram != 0xFFFF) printf("%u", ram);
+	printf(",%u,%u", (uint16_t)get16(p + 13), p[15]);
+	// queue and loss counters
+	printf(",%u,%u,%u,%u,%u\n", p[16], (uint16_t)get16(p + 17), (uint16_t)get16(p + 19),
+		(uint16_t)get16(p + 21), (uint16_t)get16(p + 23));
+}
+
+static void hist_head(const uint8_t *p)
+{
+	hist.active = 1;
+	hist.base = get16(p);
+	hist.records = (uint16_t)get16(p + 2);
+	hist.bytes = (uint16_t)get16(p + 4);
+	hist.period = (uint16_t)get16(p + 6);
+	hist.age = (uint16_t)get16(p + 8);
+	hist.lost = (uint16_t)get16(p + 10);
+	hist.got = 0;
+	if (hist.lost) fprintf(stderr, "hist: %u records lost to long exports, older times are off\n", hist.lost);
+	if (hist.bytes > HIST_SIZE) hist.active = 0;
+}
+
+// Print the records once all bytes are in, in order
+static void hist_data(const uint8_t *p, int len)
+{
+	unsigned off = (uint16_t)get16(p), i = 0, n = 0;
+	int temp = hist.base;
+	
+	if (!hist.active || off != hist.got || off + len - 2 > hist.bytes) {
+		fprintf(stderr, "hist: data out of order, export dropped\n");
+		hist.active = 0;
+		return;
+	}
+	memcpy(hist.data + off, p + 2, len - 2);
+	hist.got += len - 2;
+	if (hist.got < hist.bytes) return;
+	
+	hist.active = 0;
+	while (i < hist.bytes) {
+		uint32_t v = 0;
+		int shift = 0;
+		uint8_t b;
+		
+		do {
+			b = hist.data[i++];
+			v |= (uint32_t)(b & 0x7F) << shift;
+			shift += 7;
+		} while ((b & 0x80) && i < hist.bytes);
+		
+		uint8_t flags = v & ((1 << HIST_FLAG_BITS) - 1);
+		v >>= HIST_FLAG_BITS;
+		temp += (int16_t)((v >> 1) ^ -(v & 1));
+		printf("hist,%ld,%.1f,%u,%u,%u\n", -(long)(hist.age + (hist.records - 1 - n) * hist.period), temp / 10.0,
+			!!(flags & HIST_F_HEATER), !!(flags & HIST_F_FAN), !!(flags & HIST_F_ALARM));
+		n++;
+	}
+	if (n != hist.records) fprintf(stderr, "hist: %u records decoded, %u announced\n", n, hist.records);
+}
+
+// Check and print the frame at the start of buf, returns the bytes used:
+// 0 when more input is needed, 1 to resync on the next byte
+static int frame(const uint8_t *buf, int n)
+{
+	int len;
+	
+	if (buf[0] != TELEM_SYNC) return 1;
+	if (n < 4) return 0;
+	len = buf[3];
+	if (len > TELEM_MAX_PAYLOAD) return 1;
+	if (n < len + TELEM_OVERHEAD) return 0;
+	if (crc16(buf + 1, len + 3) != (buf[len + 4] | buf[len + 5] << 8)) {
+		crcErrors++;
+		return 1;
+	}
+	
+	frames++;
+	if (lastSeq >= 0 && buf[2] != (uint8_t)(lastSeq + 1)) {
+		lost += (uint8_t)(buf[2] - lastSeq - 1);
+		fprintf(stderr, "seq gap %d -> %u\n", lastSeq, buf[2]);
+	}
+	lastSeq = buf[2];
+	
+	if (buf[1] == TELEM_STATUS && len == TELEM_STATUS_LEN) status(buf[2], buf + 4);
+	else if (buf[1] == TELEM_TEXT) printf("# %.*s\n", len, (const char *)buf + 4);
+	else if (buf[1] == TELEM_HIST_HEAD && len == HIST_HEAD_LEN) hist_head(buf + 4);
+	else if (buf[1] == TELEM_HIST_DATA && len > 2) hist_data(buf + 4, len);
+	else fprintf(stderr, "seq %u: unknown frame type %u, %d bytes\n", buf[2], buf[1], len);
+	fflush(stdout);
+	return len + TELEM_OVERHEAD;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t buf[256];
+	char cmd[64];
+	int fd = 0, n = 0, r, used, tty;
+	struct termios tio;
+	struct pollfd pfd[2];
+	
+	if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+		fprintf(stderr, "usage: telem_decode [tty|pty|fifo|file]\n");
+		return 1;
+	}
+	if (argc == 2 && (fd = open(argv[1], O_RDONLY | O_NOCTTY)) < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	tty = argc == 2 && isatty(fd);
+	if (tty) {
+		close(fd);
+		if ((fd = open(argv[1], O_RDWR | O_NOCTTY)) < 0) {
+			perror(argv[1]);
+			return 1;
+		}
+		tcgetattr(fd, &tio);
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, B38400);
+		cfsetospeed(&tio, B38400);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	
+	printf("seq,temp,raw,set,out,fan_duty,mode,heater,fan,alarm,alarm_use,lock,saving,free_ram,wakeups,asleep,lcd_hwm,lcd_dropped,adc_overruns,rx_overruns,tx_dropped\n");
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = tty ? 0 : -1;
+	pfd[1].events = POLLIN;
+	while (poll(pfd, 2, -1) > 0) {
+		if (pfd[1].revents) {
+			// commands from stdin, stop reading it at EOF
+			if ((r = read(0, cmd, sizeof(cmd))) > 0) {
+				if (write(fd, "\n", 1) < 0) perror("write");
+				tcdrain(fd);
+				usleep(WAKE_MS * 1000);
+				if (write(fd, "\n", 1) < 0 || write(fd, cmd, r) < 0) perror("write");
+			} else pfd[1].fd = -1;
+		}
+		if (!pfd[0].revents) continue;
+		if ((r = read(fd, buf + n, sizeof(buf) - n)) <= 0) break;
+		n += r;
+		while (n && (used = frame(buf, n))) {
+			if (used == 1 && buf[0] != TELEM_SYNC) skipped++;
+			memmove(buf, buf + used, n - used);
+			n -= used;
+		}
+	}
+	
+	fprintf(stderr, "%lu frames, %lu lost, %lu crc errors, %lu bytes skipped\n", frames, lost, crcErrors, skipped);
+	return 0;
+}
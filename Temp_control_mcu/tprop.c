@@ -0,0 +1,116 @@
+/*
+ * tprop.c
+ *
+ * Time-proportioning output scheduler for slow switched loads
+ */ 
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "hal.h"
+#include "tprop.h"
+
+#if TPROP_WINDOW_TICKS % TPROP_STEP_TICKS
+#error "TPROP_WINDOW_TICKS must be a multiple of TPROP_STEP_TICKS"
+#endif
+#if TPROP_MIN_ON_TICKS + TPROP_MIN_OFF_TICKS > TPROP_WINDOW_TICKS
+#error "TPROP minimum on + off time longer than the window"
+#endif
+#if TPROP_NUM_CHANNELS > TPROP_WINDOW_TICKS
+#error "TPROP needs a window tick per channel to stagger the outputs"
+#endif
+
+static const uint8_t pins[TPROP_NUM_CHANNELS] PROGMEM = { TPROP_PIN_LIST };
+
+typedef struct{
+	uint16_t phase;		// position in the window
+	uint16_t onTicks;	// on time of the running window
+	uint16_t held;		// ticks since the last switch
+	uint8_t on;
+}tpropCh_t;
+
+// Requested on time, written by tprop_set(), latched at each window start
+static volatile uint16_t demand[TPROP_NUM_CHANNELS];
+
+// Output state, written by tprop_tick() only
+static tpropCh_t chans[TPROP_NUM_CHANNELS];
+
+// All outputs off, windows spread evenly over the first window
+void tprop_init()
+{
+	uint8_t i;
+	
+	for (i = 0; i < TPROP_NUM_CHANNELS; i++) {
+		hal_out_clear(pgm_read_byte(&pins[i]));
+		demand[i] = 0;
+		chans[i].phase = (uint16_t)i * TPROP_WINDOW_TICKS / TPROP_NUM_CHANNELS;
+		chans[i].onTicks = 0;
+		chans[i].held = 0xFFFF;
+		chans[i].on = 0;
+	}
+}
+
+// Demand in percent, takes effect from the next window of the channel
+void tprop_set(uint8_t ch, uint8_t percent)
+{
+	uint16_t t;
+	
+	if (percent > 100) percent = 100;
+	// round to the resolution, then honour the minimum on and off times
+	t = ((uint32_t)percent * TPROP_WINDOW_TICKS + 50) / 100;
+	t = (t + TPROP_STEP_TICKS / 2) / TPROP_STEP_TICKS * TPROP_STEP_TICKS;
+	if (t < TPROP_MIN_ON_TICKS) t = 0;
+	else if (TPROP_WINDOW_TICKS - t < TPROP_MIN_OFF_TICKS) t = TPROP_WINDOW_TICKS;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		demand[ch] = t;
+	}
+}
+
+// Call once per timer tick with interrupts off (Timer0 ISR)
+void tprop_tick()
+{
+	uint8_t i, want, switched = 0;
+	tpropCh_t *c;
+	
+	for (i = 0; i < TPROP_NUM_CHANNELS; i++) {
+		c = &chans[i];
+		if (++c->phase >= TPROP_WINDOW_TICKS) {
+			c->phase = 0;
+			c->onTicks = demand[i];
+		}
+		if (c->held != 0xFFFF) c->held++;
+		
+		// on for the first onTicks of the window
+		want = c->phase < c->onTicks;
+		if (want == c->on || switched) continue;
+		if (c->held < (c->on ? TPROP_MIN_ON_TICKS : TPROP_MIN_OFF_TICKS)) continue;
+		
+		if (want) hal_out_set(pgm_read_byte(&pins[i]));
+		else hal_out_clear(pgm_read_byte(&pins[i]));
+		c->on = want;
+		c->held = 0;
+		switched = 1;
+	}
+}
+
+// No output switches and no window starts within the next n ticks, so
+// they may run back to back in one longer tick. Timer0 ISR only.
+uint8_t tprop_idle(uint8_t n)
+{
+	uint8_t i;
+	tpropCh_t *c;
+	
+	for (i = 0; i < TPROP_NUM_CHANNELS; i++) {
+		c = &chans[i];
+		if (c->phase + n >= TPROP_WINDOW_TICKS) return 0;
+		// on until onTicks, or a switch is still waiting
+		if (c->on ? c->phase + n >= c->onTicks : c->phase < c->onTicks) return 0;
+	}
+	return 1;
+}
+
+// Current output state of a channel
+uint8_t tprop_on(uint8_t ch)
+{
+	return chans[ch].on;
+}
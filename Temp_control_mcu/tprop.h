@@ -0,0 +1,31 @@
+/*
+ * tprop.h
+ *
+ * Time-proportioning (burst-fire) switched outputs. Every channel turns a
+ * 0-100 % demand into one on slice per window, tprop_tick() runs from the
+ * Timer0 interrupt (~98.6 Hz). Channel windows are staggered evenly and at
+ * most one output switches per tick, a clashing edge waits for the next tick.
+ */ 
+#ifndef TPROP_H
+#define TPROP_H
+
+#include <inttypes.h>
+
+// Switched outputs as hal_out_set() masks, tprop_set() index follows this order
+#define TPROP_PIN_LIST		HAL_OUT_HEATER
+#define TPROP_NUM_CHANNELS	1
+#define TPROP_CH_HEATER		0		// index of the heater bulb
+
+// Timing in Timer0 ticks, 100 ticks ~ 1 s
+#define TPROP_WINDOW_TICKS	200		// window, ~2 s (100..1000 for 1-10 s)
+#define TPROP_STEP_TICKS	2		// resolution, on time is a multiple of this
+#define TPROP_MIN_ON_TICKS	10		// shorter demands are dropped to off
+#define TPROP_MIN_OFF_TICKS	10		// shorter gaps are filled to full on
+
+void tprop_init();
+void tprop_set(uint8_t ch, uint8_t percent);
+void tprop_tick();
+uint8_t tprop_idle(uint8_t n);
+uint8_t tprop_on(uint8_t ch);
+
+#endif //TPROP_H
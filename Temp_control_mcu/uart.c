@@ -0,0 +1,146 @@
+/*
+ * uart.c
+ *
+ * Interrupt-driven USART with single-producer/single-consumer rings
+ */ 
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "hal.h"
+#include "uart.h"
+
+#if UART_TX_SIZE & (UART_TX_SIZE - 1)
+#error "UART_TX_SIZE must be a power of 2"
+#endif
+
+#if UART_RX_SIZE & (UART_RX_SIZE - 1)
+#error "UART_RX_SIZE must be a power of 2"
+#endif
+
+#define UART_TX_MASK (UART_TX_SIZE - 1)
+#define UART_RX_MASK (UART_RX_SIZE - 1)
+
+// Ring filled by the main loop (head) and drained by USART_UDRE_vect (tail)
+static uint8_t txRing[UART_TX_SIZE];
+static volatile uint8_t txHead = 0;		// end of the committed bytes
+static volatile uint8_t txTail = 0;
+static uint8_t txPut = 0;				// next free slot of the reserved space
+
+// Ring filled by USART_RXC_vect (head) and drained by the main loop (tail)
+static uint8_t rxRing[UART_RX_SIZE];
+static volatile uint8_t rxHead = 0;
+static volatile uint8_t rxTail = 0;
+static volatile uint16_t rxOverruns = 0;
+
+// Ticks until the line is quiet, set by the interrupts, counted down by uart_tick()
+static volatile uint8_t txQuiet = 0;
+static volatile uint16_t rxQuiet = 0;
+
+/*
+** ISR
+*/
+
+ISR(USART_UDRE_vect) {
+	uint8_t t = txTail;
+	
+	if (t == txHead) {
+		hal_uart_tx_irq(0);
+		return;
+	}
+	hal_uart_tx(txRing[t]);
+	txTail = (t + 1) & UART_TX_MASK;
+	txQuiet = UART_TX_QUIET_TICKS;
+}
+
+ISR(USART_RXC_vect) {
+	uint8_t byte = hal_uart_rx();
+	uint8_t next = (rxHead + 1) & UART_RX_MASK;
+	
+	rxQuiet = UART_RX_QUIET_TICKS;
+	if (next != rxTail) {
+		rxRing[rxHead] = byte;
+		rxHead = next;
+	} else rxOverruns++;
+}
+
+/*
+** Functions
+*/
+
+void uart_init()
+{
+	hal_uart_init(HAL_UART_UBRR(UART_BAUD));
+}
+
+// Reserve n bytes for uart_put(), returns 0 when the ring has no room for
+// all of them. Nothing is sent before uart_commit().
+uint8_t uart_reserve(uint8_t n)
+{
+	uint8_t h = txHead;
+	
+	if (((txTail - h - 1) & UART_TX_MASK) < n) return 0;
+	txPut = h;
+	return 1;
+}
+
+// Append one byte to the reserved space
+void uart_put(uint8_t byte)
+{
+	txRing[txPut] = byte;
+	txPut = (txPut + 1) & UART_TX_MASK;
+}
+
+// Hand the bytes put since uart_reserve() to the interrupt. The head moves
+// first, so a running UDRE interrupt cannot turn itself off behind this.
+void uart_commit()
+{
+	txHead = txPut;
+	hal_uart_tx_irq(1);
+}
+
+// Pop the oldest received byte, returns 0 when there is none
+uint8_t uart_getc(uint8_t *byte)
+{
+	uint8_t t = rxTail;
+	
+	if (t == rxHead) return 0;
+	*byte = rxRing[t];
+	rxTail = (t + 1) & UART_RX_MASK;
+	return 1;
+}
+
+// Received bytes wait in the ring
+uint8_t uart_rx_ready()
+{
+	return rxHead != rxTail;
+}
+
+// Bytes lost because the RX ring was full
+uint16_t uart_rx_overruns()
+{
+	uint16_t n;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		n = rxOverruns;
+	}
+	return n;
+}
+
+// Call from the Timer0 ISR
+void uart_tick()
+{
+	if (txQuiet) txQuiet--;
+	if (rxQuiet) rxQuiet--;
+}
+
+// Bytes are on the line or expected soon, clkI/O must keep running
+uint8_t uart_busy()
+{
+	uint8_t busy;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		busy = txHead != txTail || txQuiet || rxQuiet;
+	}
+	return busy;
+}
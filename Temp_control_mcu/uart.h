@@ -0,0 +1,36 @@
+/*
+ * uart.h
+ *
+ * Interrupt-driven USART. A writer reserves room in the TX ring, puts its
+ * bytes straight into it and commits them in one go, so the interrupt never
+ * sends half a message. USART_UDRE_vect sends one byte per interrupt and
+ * turns itself off when the ring runs empty. USART_RXC_vect queues received
+ * bytes in a small RX ring for uart_getc().
+ *
+ * uart_busy() tells the ADC when stopping clkI/O would break bytes on the
+ * line: while bytes are being sent and for UART_RX_QUIET_TICKS after the
+ * last received one. A sender that starts cold should lead with a newline
+ * and a pause of a few ms, the newline may be lost but wakes this up.
+ */ 
+#ifndef UART_H
+#define UART_H
+
+#include <inttypes.h>
+
+#define UART_BAUD		38400
+#define UART_TX_SIZE	64		// bytes, power of 2, one slot stays unused
+#define UART_RX_SIZE	16		// bytes, power of 2, one slot stays unused
+#define UART_TX_QUIET_TICKS	2		// Timer0 ticks after the last byte went to UDR
+#define UART_RX_QUIET_TICKS	1000	// ~10 s, covers a terminal typed by hand
+
+void uart_init();
+uint8_t uart_reserve(uint8_t n);
+void uart_put(uint8_t byte);
+void uart_commit();
+uint8_t uart_getc(uint8_t *byte);
+uint8_t uart_rx_ready();
+uint16_t uart_rx_overruns();
+void uart_tick();
+uint8_t uart_busy();
+
+#endif //UART_H